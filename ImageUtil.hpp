@@ -1,8 +1,11 @@
 #ifndef ImageUtil_HPP
 #define ImageUtil_HPP
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <vector>
 
 namespace ImageUtil {
   enum IMG_TYPE {
@@ -15,13 +18,9 @@ namespace ImageUtil {
                  IMG_UNKNOWN,
   };
 
-  IMG_TYPE checkHeader(FILE* fp)
+  // header: the first 17 bytes of the file, zero-filled if it is shorter
+  IMG_TYPE checkHeader(const unsigned char* header)
   {
-    unsigned char header[17] = {0};
-
-    fread(header, 1, sizeof(header), fp);
-    fseek(fp, 0L, SEEK_SET);
-
     if(header[0] == 0x89 && header[1] == 0x50 &&
        header[2] == 0x4E && header[3] == 0x47 &&
        header[4] == 0x0D && header[5] == 0x0A &&
@@ -82,6 +81,16 @@ namespace ImageUtil {
     return IMG_TYPE::IMG_UNKNOWN;
   }
 
+  IMG_TYPE checkHeader(FILE* fp)
+  {
+    unsigned char header[17] = {0};
+
+    fread(header, 1, sizeof(header), fp);
+    fseek(fp, 0L, SEEK_SET);
+
+    return checkHeader(header);
+  }
+
   bool getSize(FILE* fp, IMG_TYPE type, int& width, int& height)
   {
     unsigned char buf[64] = {0};
@@ -199,6 +208,93 @@ namespace ImageUtil {
     return true;
   }
 
+  // size of a JPEG in memory, from its SOF marker
+  bool getJpegSize(const unsigned char* data, size_t size, int& width, int& height)
+  {
+    width = -1, height = -1;
+    if(size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+
+    for(size_t i = 2; i + 9 <= size;) {
+      if(data[i] != 0xFF) return false;
+
+      auto marker = data[i + 1];
+      if(marker == 0xFF) {
+        ++i;
+        continue;
+      }
+
+      // SOF0 - SOF15, except DHT, JPG and DAC
+      if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+        height = data[i + 5] << 8 | data[i + 6];
+        width = data[i + 7] << 8 | data[i + 8];
+        return width > 0 && height > 0;
+      }
+
+      i += 2 + (data[i + 2] << 8 | data[i + 3]);
+    }
+
+    return false;
+  }
+
+  // the JPEG thumbnail (IFD1) of the EXIF APP1 segment
+  bool getExifThumbnail(FILE* fp, std::vector<unsigned char>& thumbnail)
+  {
+    unsigned char buf[4];
+
+    fseek(fp, 0L, SEEK_SET);
+    if(fread(buf, 1, 2, fp) != 2 || buf[0] != 0xFF || buf[1] != 0xD8) return false;
+
+    // APPn segments before the image data
+    while(fread(buf, 1, 4, fp) == 4 && buf[0] == 0xFF && buf[1] >= 0xE0 && buf[1] <= 0xEF) {
+      int len = (buf[2] << 8 | buf[3]) - 2;
+      if(len < 0) return false;
+
+      if(buf[1] != 0xE1) {
+        fseek(fp, len, SEEK_CUR);
+        continue;
+      }
+
+      std::vector<unsigned char> app1(len);
+      if(fread(app1.data(), 1, len, fp) != static_cast<size_t>(len)) return false;
+      // APP1 is also used for XMP
+      if(len < 14 || memcmp(app1.data(), "Exif\0\0", 6) != 0) continue;
+
+      auto tiff = app1.data() + 6;
+      size_t size = len - 6;
+      bool le = tiff[0] == 'I';
+
+      auto u16 = [&](size_t i) -> unsigned long {
+        return le ? tiff[i] | tiff[i + 1] << 8 : tiff[i] << 8 | tiff[i + 1];
+      };
+      auto u32 = [&](size_t i) -> unsigned long {
+        return le ? u16(i) | u16(i + 2) << 16 : u16(i) << 16 | u16(i + 2);
+      };
+
+      if(u16(2) != 42) return false;
+
+      // IFD0 -> IFD1
+      auto ifd = u32(4);
+      if(ifd + 2 > size || ifd + 2 + u16(ifd) * 12 + 4 > size) return false;
+      ifd = u32(ifd + 2 + u16(ifd) * 12);
+      if(ifd == 0 || ifd + 2 > size || ifd + 2 + u16(ifd) * 12 > size) return false;
+
+      unsigned long offset = 0, length = 0;
+      for(unsigned long i = 0; i < u16(ifd); ++i) {
+        auto entry = ifd + 2 + i * 12;
+
+        // JPEGInterchangeFormat / JPEGInterchangeFormatLength
+        if(u16(entry) == 0x0201) offset = u32(entry + 8);
+        else if(u16(entry) == 0x0202) length = u32(entry + 8);
+      }
+      if(offset == 0 || length < 4 || offset > size || length > size - offset) return false;
+
+      thumbnail.assign(tiff + offset, tiff + offset + length);
+      return thumbnail[0] == 0xFF && thumbnail[1] == 0xD8;
+    }
+
+    return false;
+  }
+
   void CalcScaleSize_KeepAspectRatio(int srcW, int srcH,
                                      int scaleW, int scaleH,
                                      int& dstW, int& dstH) {
@@ -212,6 +308,47 @@ namespace ImageUtil {
     dstW = static_cast<int>(floor(srcW * ratio));
     dstH = static_cast<int>(floor(srcH * ratio));
   }
+
+  // downscales 8bit RGB pixels, every dst pixel is the average of its box
+  // of src pixels
+  void Resize_AreaAverage(const unsigned char* src, int srcW, int srcH,
+                          unsigned char* dst, int dstW, int dstH) {
+    std::vector<int> x0(dstW + 1);
+    for(int x = 0; x <= dstW; ++x) {
+      x0[x] = static_cast<long long>(x) * srcW / dstW;
+    }
+
+    // column sums of the src rows of a dst row
+    std::vector<unsigned int> sum(static_cast<size_t>(srcW) * 3);
+
+    for(int y = 0; y < dstH; ++y) {
+      int y0 = static_cast<long long>(y) * srcH / dstH;
+      int y1 = static_cast<long long>(y + 1) * srcH / dstH;
+      if(y1 <= y0) y1 = y0 + 1;
+
+      std::fill(sum.begin(), sum.end(), 0);
+      for(int sy = y0; sy < y1; ++sy) {
+        auto row = src + static_cast<size_t>(sy) * srcW * 3;
+        for(size_t i = 0; i < sum.size(); ++i) sum[i] += row[i];
+      }
+
+      auto out = dst + static_cast<size_t>(y) * dstW * 3;
+      for(int x = 0; x < dstW; ++x) {
+        int xa = x0[x], xb = x0[x + 1];
+        if(xb <= xa) xb = xa + 1;
+
+        unsigned int r = 0, g = 0, b = 0;
+        for(int sx = xa; sx < xb; ++sx) {
+          r += sum[sx * 3], g += sum[sx * 3 + 1], b += sum[sx * 3 + 2];
+        }
+
+        unsigned int n = (xb - xa) * (y1 - y0);
+        out[x * 3] = (r + n / 2) / n;
+        out[x * 3 + 1] = (g + n / 2) / n;
+        out[x * 3 + 2] = (b + n / 2) / n;
+      }
+    }
+  }
 };
 
 #endif
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <cwctype>
 
 #include <wchar.h>
@@ -85,4 +86,172 @@ int drawText(int x, int y, const std::string &str, uint16_t fg = 0, uint16_t bg
   return cnt;
 }
 
+// draws a string containing SGR escape sequences (colors, bold, underline, reverse)
+int drawAnsiText(int x, int y, const std::string &str, int len = -1) {
+  auto wstr = string2wstring(str);
+  int cnt = 0, n = static_cast<int>(wstr.length() - 1);
+  uint16_t fg = TB_DEFAULT, bg = TB_DEFAULT, attr = 0;
+  uint32_t c;
+
+  for (int i = 0; i < n; ++i) {
+    // escape sequence
+    if(wstr[i] == L'\e') {
+      if(i + 1 < n && wstr[i + 1] == L'[') {
+        std::vector<int> params(1, 0);
+        int j = i + 2;
+        for(; j < n && (iswdigit(wstr[j]) || wstr[j] == L';'); ++j) {
+          if(wstr[j] == L';') params.emplace_back(0);
+          else params.back() = params.back() * 10 + (wstr[j] - L'0');
+        }
+        i = j;
+        if(j >= n || wstr[j] != L'm') continue;
+
+        for(size_t k = 0; k < params.size(); ++k) {
+          auto p = params[k];
+
+          if(p == 0) { fg = bg = TB_DEFAULT; attr = 0; }
+          else if(p == 1) attr |= TB_BOLD;
+          else if(p == 4) attr |= TB_UNDERLINE;
+          else if(p == 7) attr |= TB_REVERSE;
+          else if(p == 22) attr &= ~TB_BOLD;
+          else if(p == 24) attr &= ~TB_UNDERLINE;
+          else if(p == 27) attr &= ~TB_REVERSE;
+          else if(p >= 30 && p <= 37) fg = p - 30 + TB_BLACK;
+          else if(p == 39) fg = TB_DEFAULT;
+          else if(p >= 40 && p <= 47) bg = p - 40 + TB_BLACK;
+          else if(p == 49) bg = TB_DEFAULT;
+          else if(p >= 90 && p <= 97) fg = (p - 90 + TB_BLACK) | TB_BOLD;
+          else if(p >= 100 && p <= 107) bg = p - 100 + TB_BLACK;
+          else if(p == 38 || p == 48) {
+            // 256 / true colors are not supported in the normal output mode
+            if(k + 1 < params.size() && params[k + 1] == 5) k += 2;
+            else if(k + 1 < params.size() && params[k + 1] == 2) k += 4;
+          }
+        }
+        continue;
+      }
+      continue;
+    }
+
+    auto wc = wstr[i];
+    if(iswcntrl(wc)) wc = L' ';
+
+    auto cw = tb_wcwidth(wc);
+    if(cw <= 0) continue;
+    if(len != -1 && cnt + cw > len) break;
+
+    char s[8] = {0};
+    wctomb(s, wc);
+    tb_utf8_char_to_unicode(&c, s);
+
+    tb_change_cell(x + cnt, y, c, fg | attr, bg);
+    cnt += cw;
+  }
+
+  return cnt;
+}
+
+// decodes a UTF-8 character, an invalid byte is decoded as '?'.
+// returns the number of bytes read.
+int decodeUtf8(const char* str, size_t len, uint32_t* ch) {
+  auto c = static_cast<unsigned char>(str[0]);
+  int n = tb_utf8_char_length(c);
+
+  if(n > 4 || static_cast<size_t>(n) > len || (c & 0xc0) == 0x80) {
+    *ch = '?';
+    return 1;
+  }
+  for(int i = 1; i < n; ++i) {
+    if((str[i] & 0xc0) != 0x80) {
+      *ch = '?';
+      return 1;
+    }
+  }
+
+  tb_utf8_char_to_unicode(ch, str);
+  return n;
+}
+
+// draws a UTF-8 string without converting it to a std::wstring.
+// returns the drawn width.
+int drawUtf8(int x, int y, const char* str, size_t len, uint16_t fg, uint16_t bg, int w = -1) {
+  int cnt = 0;
+  uint32_t c;
+
+  for(size_t i = 0; i < len;) {
+    i += decodeUtf8(str + i, len - i, &c);
+    if(iswcntrl(c)) c = ' ';
+
+    auto cw = tb_wcwidth(c);
+    if(cw <= 0) continue;
+    if(w != -1 && cnt + cw > w) break;
+
+    tb_change_cell(x + cnt, y, c, fg, bg);
+    cnt += cw;
+  }
+
+  return cnt;
+}
+
+// a string decoded once into code points with their end columns, so it can
+// be trimmed to any width by a binary search and drawn without allocations
+class DisplayText {
+public:
+  DisplayText() {}
+  explicit DisplayText(const std::string& str) { append(str.c_str(), str.length()); }
+
+  void append(const char* str, size_t len) {
+    uint32_t c;
+
+    for(size_t i = 0; i < len;) {
+      i += decodeUtf8(str + i, len - i, &c);
+      if(iswcntrl(c)) c = ' ';
+
+      auto cw = tb_wcwidth(c);
+      if(cw < 0) {
+        c = '?';
+        cw = 1;
+      }
+      if(cw == 0) continue;
+
+      chars_.push_back({c, width() + cw});
+    }
+  }
+
+  // the number of code points
+  int size() const { return chars_.size(); }
+
+  // the width of the first n code points
+  int width(int n) const { return n > 0 ? chars_[n - 1].end : 0; }
+  int width() const { return width(size()); }
+
+  // the number of code points that fit in w columns
+  int fit(int w) const {
+    return std::upper_bound(chars_.begin(), chars_.end(), w,
+                            [](int v, const Char& c) { return v < c.end; }) - chars_.begin();
+  }
+
+  // draws the code points [begin, end), returns the drawn width
+  int draw(int x, int y, int begin, int end, uint16_t fg, uint16_t bg) const {
+    for(int i = begin; i < end; ++i) {
+      tb_change_cell(x + width(i) - width(begin), y, chars_[i].ch, fg, bg);
+    }
+
+    return width(end) - width(begin);
+  }
+
+private:
+  struct Char {
+    uint32_t ch;
+    int end;
+  };
+
+  std::vector<Char> chars_;
+};
+
+void clearLine(int x, int y, int w) {
+  for(int i = 0; i < w; ++i)
+    tb_change_cell(x + i, y, ' ', TB_DEFAULT, TB_DEFAULT);
+}
+
 #endif
@@ -17,18 +17,21 @@ const char* helpstr = {
   "       ^L : Redraw\n"
   "        q : Quit\n"
   "       ^G : Quit and cd\n"
-  "        0 : View log\n"
+  "        0 : View log / jobs\n"
   "        1 : Switch tab 1\n"
   "        2 : Switch tab 2\n"
   "        3 : Switch tab 3\n"
   "        4 : Switch tab 4\n"
-  "        , : FileView simple/detail\n"
+  "        , : FileView simple/detail/gallery\n"
   "        . : Show/Hide dot files\n"
   "        i : Enable/Disable image preview\n"
   "        z : Arcive\n"
   "        Z : Current line to the middle of the screen\n"
   "        s : Sort files\n"
+  "        S : Calculate directory sizes (du mode)\n"
   "        e : Edit File\n"
+  "        f : Find files (recursive)\n"
+  "        F : Grep file contents (recursive)\n"
   "    Space : Mark file\n"
   "        u : Clear marks\n"
   "        a : Invert marks (current directory only)\n"
@@ -52,5 +55,18 @@ const char* helpstr = {
   "        U : Unmouont Directory\n"
   "       ^a : Go to archive mount directory\n"
   "        ? : Help\n"
+  "\n"
+  " Log view\n"
+  "----------------------------------------------------\n"
+  "     J, K : Select job\n"
+  "        x : Cancel job\n"
+  "        p : Pause/Resume job\n"
+  "     +, - : Raise/Lower job priority\n"
+  "\n"
+  " Gallery view\n"
+  "----------------------------------------------------\n"
+  "  h,j,k,l : Move in the grid\n"
+  "    Enter : Open file/directory\n"
+  "Backspace : Parent directory\n"
 };
 #endif
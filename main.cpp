@@ -5,13 +5,16 @@
 #include <sstream>
 #include <atomic>
 #include <deque>
+#include <list>
 #include <queue>
 #include <string>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <memory>
 #include <array>
+#include <functional>
 
 #include <linux/fs.h>
 #include <sys/syscall.h>
@@ -19,6 +22,10 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/vfs.h>
 #include <termios.h>
 #include <dirent.h>
 #include <locale.h>
@@ -26,17 +33,30 @@
 #include <signal.h>
 #include <regex.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
 #include <langinfo.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <iconv.h>
 #include <uchardet/uchardet.h>
 #include <taglib/fileref.h>
 #include <taglib/tdebuglistener.h>
+#ifdef USE_LIBSIXEL
+#include <sixel.h>
+#endif
+#ifdef USE_LIBJPEG
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
 
 #include "./termbox/termbox.h"
 #include "./libbsd/strmode.h"
 #include "./inih/INIReader.h"
 #include "./tsl/robin_set.h"
+#include "./tsl/robin_map.h"
 #include "./cpp-linenoise/linenoise.hpp"
 #include "./cmdline/cmdline.h"
 
@@ -174,9 +194,10 @@ class Config {
 public:
   Config() : logMaxlines_(100), preViewMaxlines_(50), fileViewType_(0),
              sortType_(0), sortOrder_(0),
-             useTrash_(false), wcwidthCJK_(false),
-             nanorcPath_("/usr/share/nano"), opener_("xdg-open"),
-             archiveMntDir_("~/.config/Minase/mnt")
+             useTrash_(false), wcwidthCJK_(false), icon_(false),
+             resumeCompareContent_(false), searchIndex_(false), nanorcPath_("/usr/share/nano"), opener_("xdg-open"),
+             archiveMntDir_("~/.config/Minase/mnt"), slowFsPreview_(1), slowFsPreviewBytes_(65536),
+             sixelCacheSize_(256)
   {}
 
   bool LoadConfig(const std::string& fileName) {
@@ -202,6 +223,11 @@ public:
     customMove_ = reader.Get("Options", "CustomMove", "");
     customRenamer_ = reader.Get("Options", "CustomRenamer", "");
     icon_ = reader.GetBoolean("Options", "UseIcon", false);
+    resumeCompareContent_ = reader.GetBoolean("Options", "ResumeCompareContent", false);
+    searchIndex_ = reader.GetBoolean("Options", "SearchIndex", false);
+    slowFsPreview_ = reader.GetInteger("Options", "SlowFsPreview", 1);
+    slowFsPreviewBytes_ = reader.GetInteger("Options", "SlowFsPreviewBytes", 65536);
+    sixelCacheSize_ = reader.GetInteger("Options", "SixelCacheSize", 256);
 
 #ifdef USE_MIGEMO
     migemoDict_ = reader.Get("Options", "MigemoDict", DEFAULT_MIGEMO_DICT);
@@ -324,6 +350,14 @@ public:
   std::string getCustomMove() const { return customMove_; }
   std::string getCustomRenamer() const { return customRenamer_; }
   bool useIcon() const { return icon_; }
+  bool resumeCompareContent() const { return resumeCompareContent_; }
+  bool useSearchIndex() const { return searchIndex_; }
+  // preview on network / FUSE filesystems
+  // 0: normal, 1: text only (up to getSlowFsPreviewBytes()), 2: file info only
+  int getSlowFsPreview() const { return slowFsPreview_; }
+  long getSlowFsPreviewBytes() const { return slowFsPreviewBytes_; }
+  // MB, 0: the sixel cache is not used
+  long getSixelCacheSize() const { return sixelCacheSize_; }
 
 private:
   int logMaxlines_;
@@ -334,10 +368,15 @@ private:
   bool useTrash_;
   bool wcwidthCJK_;
   bool icon_;
+  bool resumeCompareContent_;
+  bool searchIndex_;
   std::string nanorcPath_, opener_, archiveMntDir_;
   std::vector<std::string> bookmarks_;
   std::vector<Plugin> plugins_;
   std::string customCopy_, customMove_, customRenamer_;
+  int slowFsPreview_;
+  long slowFsPreviewBytes_;
+  long sixelCacheSize_;
 
 #ifdef USE_MIGEMO
   std::string migemoDict_;
@@ -346,174 +385,510 @@ private:
 
 Config config;
 
-int spawn(const std::string& cmd, const std::string& args1,
-          const std::string& args2, const std::string& args3,
-          const std::string& dir, bool gui = false, bool silent = false)
+static std::mutex slowFsMutex;
+static tsl::robin_map<dev_t, bool> slowFsCache;
+
+// network and FUSE filesystems (archivemount, sshfs, ...), where every
+// read may be a round trip. dev must be the device of path itself (not of
+// its parent), the result is cached per device.
+static bool isSlowFs(const std::string& path, dev_t dev)
+{
+  {
+    std::lock_guard<std::mutex> lock(slowFsMutex);
+    auto it = slowFsCache.find(dev);
+    if(it != slowFsCache.end()) return it -> second;
+  }
+
+  struct statfs s;
+  if(statfs(path.c_str(), &s) != 0) return false;
+
+  bool slow;
+  switch(static_cast<unsigned long>(s.f_type)) {
+  case 0x6969:      // NFS
+  case 0x517B:      // SMB
+  case 0xFF534D42:  // CIFS
+  case 0xFE534D42:  // SMB2
+  case 0x65735546:  // FUSE
+  case 0x01021997:  // 9P
+  case 0x00C36400:  // CEPH
+  case 0x73757245:  // CODA
+  case 0x5346414F:  // AFS
+  case 0x564C:      // NCP
+    slow = true;
+    break;
+
+  default:
+    slow = false;
+  }
+
+  std::lock_guard<std::mutex> lock(slowFsMutex);
+  slowFsCache[dev] = slow;
+
+  return slow;
+}
+
+// the device numbers of FUSE filesystems are reused after an unmount
+static void clearSlowFsCache()
 {
-  bool chDir = dir.empty() ? false : true;
-  pid_t pid;
+  std::lock_guard<std::mutex> lock(slowFsMutex);
+  slowFsCache.clear();
+}
+
+/*
+ * A child process started with posix_spawn. Unlike fork() it does not copy
+ * the page tables of Minase, and it is safe while the worker threads hold
+ * locks. The process is waited for when the handle is destroyed.
+ */
+class Process {
+public:
+  enum Output {
+    INHERIT,     // the terminal of Minase
+    PIPE,        // stdout to a pipe read by read(), stdin and stderr to /dev/null
+    PIPE_STDERR, // stdout and stderr to the pipe
+    DETACH,      // a new session, stdout and stderr to /dev/null, reaped in the background
+  };
+
+  Process() : pid_(-1), fd_(-1), signaled_(false) {}
+  ~Process() { wait(); }
 
-  if(!gui) {
-    if(!silent) tb_shutdown();
-    pid = fork();
+  Process(const Process&) = delete;
+  Process& operator=(const Process&) = delete;
 
-    if(pid < 0) return -1;
-    else if(pid == 0) {
-      if(chDir) chdir(dir.c_str());
-      signal(SIGINT, SIG_DFL);
-      signal(SIGQUIT, SIG_DFL);
+  // runs argv[0] searched in PATH. dir is the working directory of the
+  // child if it is not empty.
+  bool start(std::vector<std::string> argv, Output output = INHERIT, const std::string& dir = "") {
+    if(argv.empty() || pid_ > 0) return false;
 
-      execlp(cmd.c_str(), cmd.c_str(),
-             args1.empty() ? NULL : args1.c_str(),
-             args2.empty() ? NULL : args2.c_str(),
-             args3.empty() ? NULL : args3.c_str(),
-             NULL);
+#ifndef USE_SPAWN_ADDCHDIR
+    if(!dir.empty()) {
+      argv.insert(argv.begin(), {"sh", "-c", "cd -- \"$1\" && shift && exec \"$@\"", "sh", dir});
+    }
+#endif
+
+    std::vector<char*> args;
+    for(auto& s: argv) args.emplace_back(&s[0]);
+    args.push_back(0);
+
+    int pipefd[2] = {-1, -1};
+    bool pipe = output == PIPE || output == PIPE_STDERR;
+    if(pipe && pipe2(pipefd, O_CLOEXEC) != 0) return false;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+#ifdef USE_SPAWN_ADDCHDIR
+    if(!dir.empty()) posix_spawn_file_actions_addchdir_np(&actions, dir.c_str());
+#endif
+
+    if(pipe) {
+      posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+      posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+      if(output == PIPE_STDERR) posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+      else posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    else if(output == DETACH) {
+      posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+      posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    }
+
+    // Minase ignores SIGINT and SIGQUIT, the child should not
+    sigset_t sigdef, sigmask;
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGINT);
+    sigaddset(&sigdef, SIGQUIT);
+    sigemptyset(&sigmask);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawnattr_setsigmask(&attr, &sigmask);
+
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    if(output == DETACH) {
+#ifdef POSIX_SPAWN_SETSID
+      flags |= POSIX_SPAWN_SETSID;
+#else
+      flags |= POSIX_SPAWN_SETPGROUP;
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
 
-      _exit(1);
+    pid_t pid;
+    int err = posix_spawnp(&pid, args[0], &actions, &attr, args.data(), environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if(pipe) close(pipefd[1]);
+
+    if(err != 0) {
+      if(pipe) close(pipefd[0]);
+      errno = err;
+      return false;
     }
 
-    int stat = 0;
-    waitpid(pid, &stat, 0);
-    if(WIFSIGNALED(stat)) printf("\n");
+    if(output == DETACH) {
+      std::thread([pid] {
+          int stat;
+          while(waitpid(pid, &stat, 0) == -1 && errno == EINTR);
+        }).detach();
 
-    if(!silent) tb_init();
+      return true;
+    }
 
-    if(WIFEXITED(stat)) {
-      return WEXITSTATUS(stat);
+    pid_ = pid;
+    signaled_ = false;
+    if(pipe) {
+      fd_ = pipefd[0];
+      fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
     }
+
+    return true;
   }
-  else {
-    pid = fork();
-
-    if(pid < 0) return -1;
-    else if(pid == 0) {
-      pid_t pid2 = fork();
-
-      if(pid2 < 0) _exit(1);
-      else if(pid2 == 0) {
-        if(chDir) chdir(dir.c_str());
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        setsid();
-
-        int fd = open("/dev/null", O_WRONLY, 0200);
-        dup2(fd, STDOUT_FILENO);
-        dup2(fd, STDERR_FILENO);
-        close(fd);
 
-        execlp(cmd.c_str(), cmd.c_str(),
-               args1.empty() ? NULL : args1.c_str(),
-               args2.empty() ? NULL : args2.c_str(),
-               args3.empty() ? NULL : args3.c_str(),
-               NULL);
+  pid_t getPid() const { return pid_; }
 
-        _exit(1);
-      }
+  // appends the output of the child to buf, waiting for it up to timeout
+  // ms (-1: until there is some). returns false at the end of the output.
+  bool read(std::string& buf, int timeout = -1) {
+    if(fd_ == -1) return false;
+
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+
+    int n = poll(&pfd, 1, timeout);
+    if(n == 0 || (n == -1 && errno == EINTR)) return true;
+
+    char rbuf[65536];
+    ssize_t len = n > 0 ? ::read(fd_, rbuf, sizeof(rbuf)) : -1;
+    if(len > 0) {
+      buf.append(rbuf, len);
+      return true;
+    }
+    if(len == -1 && (errno == EAGAIN || errno == EINTR)) return true;
+
+    close(fd_);
+    fd_ = -1;
+
+    return false;
+  }
 
-      _exit(0);
+  // the exit status, -1 if the child is killed by a signal or not started
+  int wait() {
+    if(fd_ != -1) {
+      close(fd_);
+      fd_ = -1;
     }
+    if(pid_ <= 0) return -1;
 
     int stat = 0;
-    waitpid(pid, &stat, 0);
+    while(waitpid(pid_, &stat, 0) == -1 && errno == EINTR);
+    pid_ = -1;
+
+    signaled_ = WIFSIGNALED(stat);
+    return WIFEXITED(stat) ? WEXITSTATUS(stat) : -1;
   }
 
-  return 0;
-}
+  bool isSignaled() const { return signaled_; }
 
-pid_t popen2(const std::string& cmd,
-             const std::vector<std::string>& args, int *infp, int *outfp, bool stderr_out = false)
+private:
+  pid_t pid_;
+  int fd_;
+  bool signaled_;
+};
+
+int spawn(const std::string& cmd, const std::string& args1,
+          const std::string& args2, const std::string& args3,
+          const std::string& dir, bool gui = false, bool silent = false)
 {
-  int p_stdin[2], p_stdout[2];
-  pid_t pid;
+  std::vector<std::string> argv{cmd};
+  for(auto arg: {&args1, &args2, &args3}) {
+    if(arg -> empty()) break;
+    argv.emplace_back(*arg);
+  }
 
-  if(pipe(p_stdin) != 0)
-    return -1;
+  Process process;
+  if(gui) return process.start(argv, Process::DETACH, dir) ? 0 : -1;
 
-  if(pipe(p_stdout) != 0) {
-    close(p_stdin[0]);
-    close(p_stdin[1]);
+  if(!silent) tb_shutdown();
 
-    return -1;
+  int result = process.start(argv, Process::INHERIT, dir) ? process.wait() : -1;
+  if(process.isSignaled()) {
+    printf("\n");
+    result = 0;
   }
 
-  std::vector<char*> argc;
-  argc.emplace_back(const_cast<char*>(cmd.c_str()));
-  for(auto const& s : args)
-    argc.emplace_back(const_cast<char*>(s.c_str()));
-  argc.push_back(0);
+  if(!silent) tb_init();
 
-  pid = fork();
+  return result;
+}
 
-  if(pid < 0) {
-    close(p_stdin[0]);
-    close(p_stdin[1]);
-    close(p_stdout[0]);
-    close(p_stdout[1]);
+/*
+ * The executables in PATH. PATH is scanned in the background at startup
+ * and again only when it or the mtime of one of its directories has
+ * changed. The names are kept sorted in one buffer for prefix search.
+ */
+class CommandIndex {
+public:
+  CommandIndex() : scanning_(false) {}
 
-    return pid;
+  ~CommandIndex() {
+    if(thread_.joinable()) thread_.join();
   }
-  else if(pid == 0) {
-    dup2(p_stdin[0], STDIN_FILENO);
-    dup2(p_stdout[1], STDOUT_FILENO);
 
-    if(stderr_out) dup2(p_stdout[1], STDERR_FILENO);
-    else {
-      int fd = open("/dev/null", O_WRONLY, 0200);
+  // scan PATH in the background
+  void prefetch() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(scanning_) return;
 
-      dup2(fd, STDERR_FILENO);
-      close(fd);
+    if(thread_.joinable()) thread_.join();
+
+    auto env = getenv("PATH");
+    std::string path = env != 0 ? env : "";
+
+    scanning_ = true;
+    thread_ = std::thread([this, path] {
+        std::shared_ptr<const Index> index(scan(path));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_ = index;
+        scanning_ = false;
+        cv_.notify_all();
+      });
+  }
+
+  // the path of the executable cmd, searched in PATH if it has no slash.
+  // "" if there is none.
+  std::string find(const std::string& cmd) {
+    if(cmd.find('/') != std::string::npos)
+      return faccessat(AT_FDCWD, cmd.c_str(), X_OK, 0) == 0 ? cmd : "";
+
+    auto index = get();
+    auto range = index -> equalRange(cmd);
+    if(range.first == range.second) return "";
+
+    return index -> dirs[range.first -> dir].path + cmd;
+  }
+
+  // the names of the executables that start with prefix, sorted
+  void complete(const std::string& prefix, std::vector<std::string>& result) {
+    auto index = get();
+    auto range = index -> prefixRange(prefix);
+
+    for(auto it = range.first; it != range.second; ++it)
+      result.emplace_back(index -> getName(*it));
+  }
+
+private:
+  struct Dir {
+    std::string path;
+    timespec mtime;
+  };
+
+  // a name in Index::names and the directory it was found in
+  struct Entry {
+    uint32_t name;
+    uint32_t dir;
+  };
+
+  struct Index {
+    typedef std::vector<Entry>::const_iterator Iterator;
+
+    std::string path;
+    std::vector<Dir> dirs;
+    std::string names; // NUL separated
+    std::vector<Entry> entries; // sorted by name
+
+    const char* getName(const Entry& e) const { return names.c_str() + e.name; }
+
+    std::pair<Iterator, Iterator> equalRange(const std::string& name) const {
+      return std::equal_range(entries.begin(), entries.end(), name.c_str(),
+                              Less{this, std::string::npos});
     }
 
-    close(p_stdin[0]);
-    close(p_stdin[1]);
-    close(p_stdout[0]);
-    close(p_stdout[1]);
+    // compares only the first prefix.size() bytes of the names
+    std::pair<Iterator, Iterator> prefixRange(const std::string& prefix) const {
+      return std::equal_range(entries.begin(), entries.end(), prefix.c_str(),
+                              Less{this, prefix.size()});
+    }
+
+    struct Less {
+      const Index* index;
+      size_t n;
+
+      bool operator()(const Entry& a, const char* b) const {
+        return strncmp(index -> getName(a), b, n) < 0;
+      }
+      bool operator()(const char* a, const Entry& b) const {
+        return strncmp(a, index -> getName(b), n) < 0;
+      }
+    };
+  };
+
+  // the index, waiting for the background scan, scanned again if PATH has
+  // changed
+  std::shared_ptr<const Index> get() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !scanning_; });
 
-    execvp(cmd.c_str(), argc.data());
-    perror("execvp");
-    _exit(1);
+    auto env = getenv("PATH");
+    std::string path = env != 0 ? env : "";
+
+    if(!index_ || isStale(*index_, path)) index_.reset(scan(path));
+
+    return index_;
   }
 
-  close(p_stdin[0]);
-  close(p_stdout[1]);
+  static bool isStale(const Index& index, const std::string& path) {
+    if(index.path != path) return true;
 
-  if(infp == NULL) close(p_stdin[1]);
-  else *infp = p_stdin[1];
+    for(const auto& dir: index.dirs) {
+      struct stat st;
+      timespec mtime{0, 0};
+      if(stat(dir.path.c_str(), &st) == 0) mtime = st.st_mtim;
 
-  if(outfp == NULL) close(p_stdout[0]);
-  else *outfp = p_stdout[0];
+      if(mtime.tv_sec != dir.mtime.tv_sec || mtime.tv_nsec != dir.mtime.tv_nsec) return true;
+    }
 
-  return pid;
-}
+    return false;
+  }
 
-int pclose2(pid_t pid)
-{
-  int stat;
-  waitpid(pid, &stat, 0);
+  static Index* scan(const std::string& path) {
+    std::unique_ptr<Index> index(new Index);
+    index -> path = path;
+
+    std::istringstream stream(path);
+    std::string dirPath;
+
+    while(std::getline(stream, dirPath, ':')) {
+      // a relative directory would follow the directory of the file view
+      if(dirPath.empty() || dirPath[0] != '/') continue;
+      if(dirPath.back() != '/') dirPath += '/';
+
+      // a directory that does not exist yet is watched too
+      struct stat st;
+      timespec mtime{0, 0};
+      if(stat(dirPath.c_str(), &st) == 0) mtime = st.st_mtim;
+
+      uint32_t dirIndex = index -> dirs.size();
+      index -> dirs.emplace_back(Dir{dirPath, mtime});
+
+      int fd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if(fd == -1) continue;
+
+      auto dir = fdopendir(fd);
+      if(dir == NULL) {
+        close(fd);
+        continue;
+      }
 
-  return WEXITSTATUS(stat);
+      struct dirent* dent;
+      while((dent = readdir(dir)) != NULL) {
+        auto name = dent -> d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        // stat only what d_type does not tell
+        if(dent -> d_type == DT_DIR) continue;
+        if(dent -> d_type != DT_REG) {
+          if(dent -> d_type != DT_LNK && dent -> d_type != DT_UNKNOWN) continue;
+          if(fstatat(fd, name, &st, 0) != 0 || S_ISDIR(st.st_mode)) continue;
+        }
+        if(faccessat(fd, name, X_OK, 0) != 0) continue;
+
+        index -> entries.emplace_back(Entry{static_cast<uint32_t>(index -> names.size()), dirIndex});
+        index -> names.append(name, strlen(name) + 1);
+      }
+      closedir(dir);
+    }
+
+    // the first directory in PATH wins
+    auto names = index -> names.c_str();
+    std::stable_sort(index -> entries.begin(), index -> entries.end(),
+                     [names](const Entry& a, const Entry& b) {
+                       return strcmp(names + a.name, names + b.name) < 0;
+                     });
+    index -> entries.erase(std::unique(index -> entries.begin(), index -> entries.end(),
+                                       [names](const Entry& a, const Entry& b) {
+                                         return strcmp(names + a.name, names + b.name) == 0;
+                                       }),
+                           index -> entries.end());
+
+    return index.release();
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  bool scanning_;
+  std::shared_ptr<const Index> index_;
+};
+CommandIndex commandIndex;
+
+bool which(const std::string& cmd)
+{
+  return !commandIndex.find(cmd).empty();
 }
 
-bool which(std::string cmd)
+/*
+ * Known file suffixes: the icon of icons.hpp and whether it is an audio
+ * file read by TagLib. Built once; a FileInfo looks up its suffix when it
+ * is created.
+ */
+struct SuffixType {
+  const char* icon;
+  bool audio;
+};
+
+static const SuffixType* findSuffixType(const std::string& name)
 {
-  auto shell = getenv("SHELL");
-  if(shell == 0) return false;
+  struct Table {
+    tsl::robin_map<std::string, SuffixType> types;
+    size_t maxLength;
 
-  if(spawn(shell, "-c", "which " + cmd + " > /dev/null", "", "", false, true) == 0)
-    return true;
-  else return false;
+    Table() : maxLength(0) {
+      static const char* const audio[] = {
+        "mp3", "mp4", "flac", "wav", "ogg", "wv", "tta", "aiff", "asf"
+      };
+
+      // the first match of icons[] is used
+      for(const auto& icon : icons) {
+        types.insert({icon.match, SuffixType{icon.icon, false}});
+      }
+      for(auto suffix : audio) {
+        types.insert({suffix, SuffixType{0, false}}).first.value().audio = true;
+      }
+      for(const auto& type : types) maxLength = std::max(maxLength, type.first.length());
+    }
+  };
+  static const Table table;
+
+  auto i = name.find_last_of('.');
+  if(i == 0 || i == std::string::npos) return 0;
+
+  auto length = name.length() - i - 1;
+  if(length == 0 || length > table.maxLength) return 0;
+
+  std::string suffix(length, '\0');
+  for(size_t j = 0; j < length; ++j) suffix[j] = tolower(static_cast<unsigned char>(name[i + 1 + j]));
+
+  auto it = table.types.find(suffix);
+  return it != table.types.end() ? &it -> second : 0;
 }
 
 class FileInfo {
 public:
-  FileInfo(const std::string& path, const std::string& fileName) :
-    path_(path), name_(fileName) {
+  // followLink: false does not stat the target of a symlink, which is
+  // then not a directory
+  FileInfo(const std::string& path, const std::string& fileName, bool followLink = true) :
+    path_(path), name_(fileName), dirSize_(-1), matchLine_(0), suffixType_(0) {
 
     if(!path.empty()) {
       lstat(std::string(path_ + name_).c_str(), &lstat_);
 
       if(S_ISDIR(lstat_.st_mode)) dir_ = true;
-      else if(S_ISLNK(lstat_.st_mode)) {
+      else if(S_ISLNK(lstat_.st_mode) && followLink) {
         struct stat s;
         stat(std::string(path_ + name_).c_str(), &s);
         dir_ = S_ISDIR(s.st_mode);
@@ -522,10 +897,21 @@ public:
 
       if(isDir()) name_ += '/';
     }
+
+    if(!isDir()) suffixType_ = findSuffixType(name_);
+    setDisplayName();
   }
 
-  std::string getFileName() const { return name_; }
-  std::string getPath() const { return path_; }
+  // the filesystem of the file (of the target of a link) is a slow one
+  bool isOnSlowFs() const {
+    if(!isLink()) return isSlowFs(getFilePath(), getDev());
+
+    struct stat s;
+    return stat(getFilePath().c_str(), &s) == 0 && isSlowFs(getFilePath(), s.st_dev);
+  }
+
+  const std::string& getFileName() const { return name_; }
+  const std::string& getPath() const { return path_; }
   std::string getFilePath() const { return path_ + name_; }
   std::string getSuffix() const {
     if(isDir()) return "";
@@ -543,8 +929,43 @@ public:
     return false;
   }
   mode_t getMode() const { return lstat_.st_mode; }
-  off_t getSize() const { return lstat_.st_size; }
+  off_t getSize() const { return dirSize_ >= 0 ? dirSize_ : lstat_.st_size; }
   timespec getMTime() const { return lstat_.st_mtim; }
+  dev_t getDev() const { return lstat_.st_dev; }
+  ino_t getIno() const { return lstat_.st_ino; }
+
+  // recursive size of a directory (du mode), -1: not calculated
+  void setDirSize(off_t size) {
+    if(dirSize_ != size) sizeText_.clear();
+    dirSize_ = size;
+  }
+  bool hasDirSize() const { return dirSize_ >= 0; }
+
+  // matching line of a content search (grep mode), 0: none
+  void setMatch(int line, const std::string& text) {
+    matchLine_ = line;
+    matchText_ = text;
+    setDisplayName();
+  }
+  int getMatchLine() const { return matchLine_; }
+  std::string getMatchText() const { return matchText_; }
+
+  // getSizeStr() / getMTimeStr() formatted once for the detail view
+  const std::string& getSizeText() const {
+    if(sizeText_.empty()) sizeText_ = getSizeStr(*this);
+    return sizeText_;
+  }
+  const std::string& getMTimeText() const {
+    if(mtimeText_.empty()) mtimeText_ = getMTimeStr(*this);
+    return mtimeText_;
+  }
+
+  // the name decoded for drawing ("name:line: text" for a match)
+  const DisplayText& getDisplayName() const { return *displayName_; }
+  // index of the '.' of the suffix in getDisplayName(), -1: none
+  int getSuffixPos() const { return suffixPos_; }
+  // 0: not a known suffix
+  const SuffixType* getSuffixType() const { return suffixType_; }
 
   static std::string getModeStr(const FileInfo& fileInfo) {
     char strMode[80];
@@ -643,113 +1064,586 @@ private:
   std::string name_;
   struct stat lstat_;
   bool dir_;
+  off_t dirSize_;
+  int matchLine_;
+  std::string matchText_;
+  std::shared_ptr<DisplayText> displayName_;
+  int suffixPos_;
+  const SuffixType* suffixType_;
+  mutable std::string sizeText_, mtimeText_;
+
+  void setDisplayName() {
+    std::shared_ptr<DisplayText> text(new DisplayText);
+    suffixPos_ = -1;
+
+    if(matchLine_ > 0) {
+      auto match = name_ + ":" + std::to_string(matchLine_) + ": " + matchText_;
+      text -> append(match.c_str(), match.length());
+    }
+    else {
+      auto i = name_.find_last_of('.');
+      if(i != 0 && i != std::string::npos && i + 1 < name_.length() && !isDir()) {
+        text -> append(name_.c_str(), i);
+        suffixPos_ = text -> size();
+        text -> append(name_.c_str() + i, name_.length() - i);
+      }
+      else text -> append(name_.c_str(), name_.length());
+    }
+
+    displayName_ = text;
+  }
 };
 
-class DirInfo {
+static const char* const DIRSIZE_CACHE_MAGIC = "MNDSIZE1";
+
+/*
+ * Recursive directory sizes for the du mode.
+ *
+ * Directories are scanned by a pool of worker threads. Every directory that
+ * is completed is stored in a cache keyed by dev/ino. A directory's mtime
+ * does not change when something deeper in its tree does, so a cached size
+ * is only a hint that is shown until the rescan of the whole tree ends.
+ * Sizes scanned in this session are not rescanned while the mtime of the
+ * directory is the same and nothing below it has been invalidated, by a
+ * file operation or by a change seen by the directory watcher of dirCache.
+ * Files with several hard links are counted once per run. Other mounted
+ * filesystems are not entered. The cache is kept in ~/.cache/Minase/dirsize.
+ */
+class DirSizeCalculator {
 public:
-  DirInfo(const std::string& path, std::atomic<bool>* kill = 0):
-    hidden_(false), sortType_(SortType::NAME), sortOrder_(SortOrder::ASCENDING), filterType_(FilterType::NORMAL) {
+  DirSizeCalculator() : kill_(false), update_(false), loaded_(false), dirty_(false), outstanding_(0) {}
 
-    switch(config.getSortType()) {
-      case 0:
-        sortType_ = SortType::NAME;
-        break;
-      case 1:
-        sortType_ = SortType::SIZE;
-        break;
-      case 2:
-        sortType_ = SortType::DATE;
-        break;
-    };
+  ~DirSizeCalculator() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      kill_ = true;
+      stack_.clear();
+    }
+    cv_.notify_all();
 
-    if(config.getSortOrder() == 0) sortOrder_ = SortOrder::ASCENDING;
-    else sortOrder_ = SortOrder::DESCENDING;
+    for(auto&& t: workers_) {
+      if(t.joinable()) t.join();
+    }
 
-    switch(config.getFilterType()) {
-    case 0:
-      filterType_ = FilterType::NORMAL;
-      break;
-    case 1:
-      filterType_ = FilterType::REGEXP;
-      break;
-#ifdef USE_MIGEMO
-    case 2:
-      filterType_ = FilterType::MIGEMO;
-      break;
-#endif
-    };
+    save();
+  }
 
-    chdir(path, kill);
+  bool get(const FileInfo& fileInfo, off_t& size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loadNL();
+
+    auto it = cache_.find(Key{fileInfo.getDev(), fileInfo.getIno()});
+    if(it == cache_.end()) return false;
+
+    size = it -> second.size;
+    return true;
   }
 
-  bool chdir(const std::string& path, std::atomic<bool>* kill = 0) {
-    if(path_ != path) filter_ = "";
-    path_ = path;
-    fileList_.clear();
-    filteredFileList_.clear();
+  // calculate the sizes of the directories in paths in the background.
+  // useCache skips the directories already scanned in this session
+  void request(const std::vector<std::string>& paths, bool useCache = true) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loadNL();
 
-    auto dir = opendir(path.c_str());
-    if(dir == NULL) return false;
+    for(const auto& path: paths) {
+      struct stat st;
+      if(lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) continue;
 
-    struct dirent* dp;
-    while((dp = readdir(dir)) != NULL) {
-      if((dp -> d_name[0] == '.' && (dp -> d_name[1] == 0 || (dp -> d_name[1] == '.' && dp -> d_name[2] == 0))))
-        continue;
-      if(kill != 0 && *kill==true) {
-        closedir(dir);
-        return false;
-      }
+      if(useCache && isFreshNL(st)) continue;
+      if(roots_.find(path) != roots_.end()) continue;
 
-      std::shared_ptr<FileInfo> fileInfo(new FileInfo(path_, dp -> d_name));
-      fileList_.emplace_back(fileInfo);
+      std::shared_ptr<Node> node(new Node(path, nullptr, st));
+      roots_.insert(path);
+      ++outstanding_;
+      stack_.emplace_back(node);
     }
-    closedir(dir);
-    filteredFileList();
 
-    return true;
+    if(stack_.empty()) return;
+
+    if(workers_.empty()) {
+      int n = std::thread::hardware_concurrency();
+      n = std::max(2, std::min(n, 8));
+
+      for(int i = 0; i < n; ++i)
+        workers_.emplace_back(&DirSizeCalculator::worker, this);
+    }
+    cv_.notify_all();
   }
 
-  void showHiddenFiles(bool flg) {
-    if(hidden_ != flg) {
-      hidden_ = flg;
-      filteredFileList();
+  // rescan path and its parents (their sizes contain it) on the next request,
+  // the old sizes are kept as hints
+  void invalidate(std::string path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loadNL();
+
+    while(!path.empty()) {
+      struct stat st;
+      if(lstat(path.c_str(), &st) == 0) {
+        auto it = cache_.find(Key{st.st_dev, st.st_ino});
+        if(it != cache_.end()) it.value().fresh = false;
+      }
+
+      if(path == "/") break;
+      if(path.back() == '/') path.pop_back();
+      path = getDirName(path) + "/";
     }
   }
 
-  bool isShowHiddenFiles() const { return hidden_; }
-  int getCount() const { return filteredFileList_.size(); }
-  FileInfo at(int index) const { return *filteredFileList_[index]; }
+  bool isUpdate() {
+    return update_.exchange(false);
+  }
 
-  enum SortType {
-    NAME,
-    SIZE,
-    DATE,
+private:
+  struct Key {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const Key& k) const { return dev == k.dev && ino == k.ino; }
   };
 
-  enum SortOrder {
-    ASCENDING,
-    DESCENDING,
+  struct KeyHash {
+    size_t operator()(const Key& k) const {
+      return std::hash<uint64_t>()(static_cast<uint64_t>(k.ino) ^
+                                   (static_cast<uint64_t>(k.dev) << 40));
+    }
   };
 
-  enum FilterType {
-    NORMAL,
-    REGEXP,
-#ifdef USE_MIGEMO
-    MIGEMO,
-#endif
+  struct Value {
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    int64_t size;
+    bool fresh;  // scanned in this session, not loaded from the file
   };
 
-  void sort(SortType type, SortOrder order) {
-    if(sortType_ != type || sortOrder_ != order) {
-      sortType_ = type;
-      sortOrder_ = order;
-      filteredFileList();
-    }
+  struct Node {
+    Node(const std::string& p, const std::shared_ptr<Node>& parent_, const struct stat& st) :
+      path(p), parent(parent_), dev(st.st_dev), ino(st.st_ino), mtime(st.st_mtim),
+      size(st.st_blocks * 512), pending(1) {}
+
+    std::string path;
+    std::shared_ptr<Node> parent;
+    dev_t dev;
+    ino_t ino;
+    timespec mtime;
+    std::atomic<int64_t> size;
+    std::atomic<int> pending;
+  };
+
+  bool isFreshNL(const struct stat& st) const {
+    auto it = cache_.find(Key{st.st_dev, st.st_ino});
+    return it != cache_.end() && it -> second.fresh &&
+      it -> second.mtimeSec == st.st_mtim.tv_sec && it -> second.mtimeNsec == st.st_mtim.tv_nsec;
   }
-  SortType getSortType() const { return sortType_; }
-  SortOrder getSortOrder() const { return sortOrder_; }
 
-  void filter(const std::string& filter, FilterType type) {
+  void worker() {
+    while(1) {
+      std::shared_ptr<Node> node;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return kill_ || !stack_.empty(); });
+        if(kill_) return;
+
+        node = stack_.back();
+        stack_.pop_back();
+      }
+
+      scan(node);
+    }
+  }
+
+  void scan(const std::shared_ptr<Node>& node) {
+    auto dir = opendir(node -> path.c_str());
+
+    if(dir != NULL) {
+      int fd = dirfd(dir);
+      struct dirent* dp;
+
+      while((dp = readdir(dir)) != NULL) {
+        if((dp -> d_name[0] == '.' && (dp -> d_name[1] == 0 || (dp -> d_name[1] == '.' && dp -> d_name[2] == 0))))
+          continue;
+        if(kill_) break;
+
+        struct stat st;
+        if(fstatat(fd, dp -> d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        if(S_ISDIR(st.st_mode)) {
+          if(st.st_dev != node -> dev) continue;
+
+          // always entered, hard links below it are counted in this run
+          std::lock_guard<std::mutex> lock(mutex_);
+          ++node -> pending;
+          stack_.emplace_back(new Node(node -> path + dp -> d_name + "/", node, st));
+          cv_.notify_one();
+        }
+        else {
+          if(st.st_nlink > 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!hardLinks_.insert(Key{st.st_dev, st.st_ino}).second) continue;
+          }
+          node -> size += st.st_blocks * 512;
+        }
+      }
+      closedir(dir);
+    }
+
+    finish(node);
+  }
+
+  void finish(std::shared_ptr<Node> node) {
+    while(node && --node -> pending == 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(kill_) return;
+
+      cache_[Key{node -> dev, node -> ino}] =
+        Value{node -> mtime.tv_sec, node -> mtime.tv_nsec, node -> size, true};
+      dirty_ = true;
+
+      if(node -> parent) {
+        node -> parent -> size += node -> size;
+      }
+      else {
+        roots_.erase(node -> path);
+        if(--outstanding_ == 0) hardLinks_.clear();
+        update_ = true;
+      }
+
+      node = node -> parent;
+    }
+  }
+
+  std::string getCacheFileName() const {
+    auto home = getenv("HOME");
+    if(home == 0) return "";
+
+    return std::string(home) + "/.cache/Minase/dirsize";
+  }
+
+  void loadNL() {
+    if(loaded_) return;
+    loaded_ = true;
+
+    auto fileName = getCacheFileName();
+    if(fileName.empty()) return;
+
+    FILE* fp;
+    if((fp = fopen(fileName.c_str(), "rb")) == NULL) return;
+
+    char magic[8];
+    if(fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+       memcmp(magic, DIRSIZE_CACHE_MAGIC, sizeof(magic)) == 0) {
+      uint64_t rec[5];
+
+      while(fread(rec, sizeof(rec), 1, fp) == 1) {
+        cache_[Key{static_cast<dev_t>(rec[0]), static_cast<ino_t>(rec[1])}] =
+          Value{static_cast<int64_t>(rec[2]), static_cast<int64_t>(rec[3]), static_cast<int64_t>(rec[4]), false};
+      }
+    }
+
+    fclose(fp);
+  }
+
+  void save() {
+    if(!dirty_) return;
+
+    auto fileName = getCacheFileName();
+    if(fileName.empty()) return;
+
+    auto dir = getDirName(getDirName(fileName));
+    mkdir(dir.c_str(), 0755);
+    mkdir(getDirName(fileName).c_str(), 0755);
+
+    auto tmp = fileName + "." + std::to_string(getpid());
+    FILE* fp;
+    if((fp = fopen(tmp.c_str(), "wb")) == NULL) return;
+
+    bool ok = fwrite(DIRSIZE_CACHE_MAGIC, 1, 8, fp) == 8;
+    for(auto it = cache_.begin(); ok && it != cache_.end(); ++it) {
+      uint64_t rec[5] = {
+        static_cast<uint64_t>(it -> first.dev), static_cast<uint64_t>(it -> first.ino),
+        static_cast<uint64_t>(it -> second.mtimeSec), static_cast<uint64_t>(it -> second.mtimeNsec),
+        static_cast<uint64_t>(it -> second.size)
+      };
+      ok = fwrite(rec, sizeof(rec), 1, fp) == 1;
+    }
+
+    if(fclose(fp) != 0) ok = false;
+    if(ok) rename(tmp.c_str(), fileName.c_str());
+    else unlink(tmp.c_str());
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+  std::deque<std::shared_ptr<Node>> stack_;
+  tsl::robin_map<Key, Value, KeyHash> cache_;
+  tsl::robin_set<Key, KeyHash> hardLinks_;
+  tsl::robin_set<std::string> roots_;
+  std::atomic<bool> kill_, update_;
+  bool loaded_, dirty_;
+  int outstanding_;
+};
+
+DirSizeCalculator dirSizeCalculator;
+
+class DirInfo {
+public:
+  DirInfo(const std::string& path, std::atomic<bool>* kill = 0):
+    hidden_(false), nameIndexValid_(false), sorted_(false), sortType_(SortType::NAME), sortOrder_(SortOrder::ASCENDING), filterType_(FilterType::NORMAL) {
+
+    switch(config.getSortType()) {
+      case 0:
+        sortType_ = SortType::NAME;
+        break;
+      case 1:
+        sortType_ = SortType::SIZE;
+        break;
+      case 2:
+        sortType_ = SortType::DATE;
+        break;
+    };
+
+    if(config.getSortOrder() == 0) sortOrder_ = SortOrder::ASCENDING;
+    else sortOrder_ = SortOrder::DESCENDING;
+
+    switch(config.getFilterType()) {
+    case 0:
+      filterType_ = FilterType::NORMAL;
+      break;
+    case 1:
+      filterType_ = FilterType::REGEXP;
+      break;
+#ifdef USE_MIGEMO
+    case 2:
+      filterType_ = FilterType::MIGEMO;
+      break;
+#endif
+    case 3:
+      filterType_ = FilterType::FUZZY;
+      break;
+    };
+
+    if(!path.empty()) chdir(path, kill);
+  }
+
+  bool chdir(const std::string& path, std::atomic<bool>* kill = 0) {
+    if(path_ != path) filter_ = "";
+    path_ = path;
+    fileList_.clear();
+    filteredFileList_.clear();
+    nameIndexValid_ = false;
+
+    auto dir = opendir(path.c_str());
+    if(dir == NULL) return false;
+
+    struct stat s;
+    bool followLink = config.getSlowFsPreview() == 0 || fstat(dirfd(dir), &s) != 0 ||
+      !isSlowFs(path, s.st_dev);
+
+    struct dirent* dp;
+    while((dp = readdir(dir)) != NULL) {
+      if((dp -> d_name[0] == '.' && (dp -> d_name[1] == 0 || (dp -> d_name[1] == '.' && dp -> d_name[2] == 0))))
+        continue;
+      if(kill != 0 && *kill==true) {
+        closedir(dir);
+        return false;
+      }
+
+      std::shared_ptr<FileInfo> fileInfo(new FileInfo(path_, dp -> d_name, followLink));
+      fileList_.emplace_back(fileInfo);
+    }
+    closedir(dir);
+    sorted_ = false;
+    filteredFileList();
+
+    return true;
+  }
+
+  // a list of files under path (names are relative paths) instead of the
+  // directory contents, e.g. search results
+  void setFiles(const std::string& path, const std::vector<std::string>& names) {
+    if(path_ != path) filter_ = "";
+    path_ = path;
+    fileList_.clear();
+
+    addFiles(names);
+  }
+
+  void addFiles(const std::vector<std::string>& names) {
+    for(const auto& name: names) {
+      std::shared_ptr<FileInfo> fileInfo(new FileInfo(path_, name));
+      fileList_.emplace_back(fileInfo);
+    }
+
+    sorted_ = false;
+    filteredFileList();
+  }
+
+  void addFiles(const std::vector<FileInfo>& files) {
+    for(const auto& file: files) {
+      std::shared_ptr<FileInfo> fileInfo(new FileInfo(file));
+      fileList_.emplace_back(fileInfo);
+    }
+
+    sorted_ = false;
+    filteredFileList();
+  }
+
+  // re-stat the files of setFiles() and drop the ones that are gone
+  void refreshFiles() {
+    std::vector<FileInfo> files;
+
+    for(const auto& file: fileList_) {
+      auto name = file -> getFileName();
+      if(file -> isDir()) name.pop_back();
+
+      struct stat s;
+      if(lstat((path_ + name).c_str(), &s) == 0) {
+        FileInfo fileInfo(path_, name);
+        fileInfo.setMatch(file -> getMatchLine(), file -> getMatchText());
+        files.emplace_back(fileInfo);
+      }
+    }
+
+    fileList_.clear();
+    addFiles(files);
+  }
+
+  void showHiddenFiles(bool flg) {
+    if(hidden_ != flg) {
+      hidden_ = flg;
+      filteredFileList();
+    }
+  }
+
+  bool isShowHiddenFiles() const { return hidden_; }
+  int getCount() const { return filteredFileList_.size(); }
+  int getFileCount() const { return fileList_.size(); }
+
+  std::vector<std::string> getDirPaths() const {
+    std::vector<std::string> result;
+
+    for(const auto& file: fileList_) {
+      if(file -> isDir() && !file -> isLink())
+        result.emplace_back(file -> getFilePath());
+    }
+
+    return result;
+  }
+
+  // apply (enable) or drop the calculated directory sizes
+  bool updateDirSizes(bool enable) {
+    bool changed = false;
+
+    for(auto&& file: fileList_) {
+      if(!file -> isDir() || file -> isLink()) continue;
+
+      off_t size = -1;
+      if(enable && !dirSizeCalculator.get(*file, size)) size = -1;
+
+      if(file -> hasDirSize() != (size >= 0) || (size >= 0 && file -> getSize() != size)) {
+        file -> setDirSize(size);
+        changed = true;
+      }
+    }
+
+    if(changed && sortType_ == SortType::SIZE) {
+      sorted_ = false;
+      filteredFileList();
+    }
+    return changed;
+  }
+  const FileInfo& at(int index) const { return *filteredFileList_[index]; }
+
+  // index of a file in the filtered list, -1: not found
+  int find(const std::string& fileName, int matchLine = 0) const {
+    if(!nameIndexValid_) {
+      nameIndex_.clear();
+      nameIndex_.reserve(filteredFileList_.size());
+
+      for(int i = 0; i < static_cast<int>(filteredFileList_.size()); ++i) {
+        const auto& file = *filteredFileList_[i];
+        nameIndex_.emplace(NameKey{&file.getFileName(), file.getMatchLine()}, i);
+      }
+      nameIndexValid_ = true;
+    }
+
+    auto it = nameIndex_.find(NameKey{&fileName, matchLine});
+    if(it == nameIndex_.end()) return -1;
+    return it -> second;
+  }
+
+  enum SortType {
+    NAME,
+    SIZE,
+    DATE,
+  };
+
+  enum SortOrder {
+    ASCENDING,
+    DESCENDING,
+  };
+
+  enum FilterType {
+    NORMAL,
+    REGEXP,
+#ifdef USE_MIGEMO
+    MIGEMO,
+#endif
+    FUZZY,
+  };
+
+  static char getFilterTypeChar(FilterType type) {
+    switch(type) {
+    case NORMAL:
+      return 'N';
+    case REGEXP:
+      return 'R';
+#ifdef USE_MIGEMO
+    case MIGEMO:
+      return 'M';
+#endif
+    case FUZZY:
+      return 'F';
+    };
+
+    return 'N';
+  }
+
+  void sort(SortType type, SortOrder order) {
+    if(sortType_ != type || sortOrder_ != order) {
+      sortType_ = type;
+      sortOrder_ = order;
+      sorted_ = false;
+      filteredFileList();
+    }
+  }
+  SortType getSortType() const { return sortType_; }
+  SortOrder getSortOrder() const { return sortOrder_; }
+
+  // a copy of the entries that does not share FileInfo (e.g. the directory
+  // sizes) with the list, and how they are sorted
+  struct Snapshot {
+    std::vector<std::shared_ptr<FileInfo>> files;
+    bool sorted;
+    SortType sortType;
+    SortOrder sortOrder;
+  };
+
+  Snapshot getSnapshot() const {
+    return Snapshot{copyFiles(fileList_), sorted_, sortType_, sortOrder_};
+  }
+
+  // same as chdir(path) with the entries of a snapshot instead of reading
+  // the directory. they are sorted again only if the order differs.
+  void load(const std::string& path, const Snapshot& snapshot) {
+    if(path_ != path) filter_ = "";
+    path_ = path;
+    fileList_ = copyFiles(snapshot.files);
+    sorted_ = snapshot.sorted && snapshot.sortType == sortType_ && snapshot.sortOrder == sortOrder_;
+    filteredFileList();
+  }
+
+  void filter(const std::string& filter, FilterType type) {
     filter_ = filter;
     filterType_ = type;
 
@@ -762,7 +1656,6 @@ public:
     return filterType_;
   }
 
-private:
   class Filter {
   public:
     Filter() {}
@@ -770,6 +1663,32 @@ private:
     virtual bool isMatch(const std::string& fileName) { (void)fileName; return true; };
   };
 
+  static std::shared_ptr<Filter> createFilter(const std::string& filter, FilterType type) {
+    std::shared_ptr<Filter> filterFunc(new Filter);
+
+    if(!filter.empty()) {
+      switch(type) {
+      case NORMAL:
+        filterFunc.reset(new NormalFilter(filter));
+        break;
+      case REGEXP:
+        filterFunc.reset(new RegexpFilter(filter));
+        break;
+#ifdef USE_MIGEMO
+      case MIGEMO:
+        filterFunc.reset(new MigemoFilter(filter));
+        break;
+#endif
+      case FUZZY:
+        filterFunc.reset(new FuzzyFilter(filter));
+        break;
+      };
+    }
+
+    return filterFunc;
+  }
+
+private:
   class NormalFilter : public Filter {
   public:
     NormalFilter(const std::string& filter) {
@@ -861,26 +1780,51 @@ private:
   };
 #endif
 
-  void filteredFileList() {
-    filteredFileList_.clear();
-    std::unique_ptr<Filter> filterFunc(new Filter);
+  // characters of the filter in order, e.g. "mcp" matches "main.cpp"
+  class FuzzyFilter : public Filter {
+  public:
+    FuzzyFilter(const std::string& filter) {
+      for(auto c: filter) {
+        if(c != ' ') filter_.push_back(toupper(c));
+      }
+    }
+    ~FuzzyFilter() {}
 
-    if(!filter_.empty()) {
-      switch(filterType_) {
-      case NORMAL:
-        filterFunc.reset(new NormalFilter(filter_));
-        break;
-      case REGEXP:
-        filterFunc.reset(new RegexpFilter(filter_));
-        break;
-#ifdef USE_MIGEMO
-      case MIGEMO:
-        filterFunc.reset(new MigemoFilter(filter_));
-        break;
-#endif
-      };
+    bool isMatch(const std::string& fileName) {
+      size_t i = 0;
+
+      for(auto c: fileName) {
+        if(i == filter_.length()) break;
+        if(toupper(c) == filter_[i]) ++i;
+      }
+
+      return i == filter_.length();
+    }
+
+  private:
+    std::string filter_;
+  };
+
+  static std::vector<std::shared_ptr<FileInfo>> copyFiles(const std::vector<std::shared_ptr<FileInfo>>& files) {
+    std::vector<std::shared_ptr<FileInfo>> result;
+    result.reserve(files.size());
+
+    for(const auto& file: files) {
+      std::shared_ptr<FileInfo> fileInfo(new FileInfo(*file));
+      result.emplace_back(fileInfo);
     }
 
+    return result;
+  }
+
+  // fileList_ is kept sorted, so filtering does not sort again
+  void filteredFileList() {
+    if(!sorted_) sortList();
+
+    filteredFileList_.clear();
+    nameIndexValid_ = false;
+    auto filterFunc = createFilter(filter_, filterType_);
+
     for(auto&& file: fileList_) {
       if(!(filterFunc -> isMatch(file -> getFileName()))) continue;
 
@@ -890,8 +1834,6 @@ private:
       }
       else filteredFileList_.emplace_back(file);
     }
-
-    sortList();
   }
 
   void sortList() {
@@ -933,87 +1875,657 @@ private:
     if(sortOrder_ == SortOrder::DESCENDING)
       func = std::bind(func, std::placeholders::_2, std::placeholders::_1);
 
-    std::sort(filteredFileList_.begin(), filteredFileList_.end(),
-              [func](const FileInfo_Ptr& a, const FileInfo_Ptr& b) {
-                if(a -> isDir() && b -> isDir())
-                  return func(a, b);
-                else if(a -> isDir() && !b -> isDir())
-                  return true;
-                else if(!a -> isDir() && b -> isDir())
-                  return false;
-                else return func(a, b);;
-              });
+    // stable, so the matches of a content search stay in line order
+    std::stable_sort(fileList_.begin(), fileList_.end(),
+                     [func](const FileInfo_Ptr& a, const FileInfo_Ptr& b) {
+                       if(a -> isDir() && b -> isDir())
+                         return func(a, b);
+                       else if(a -> isDir() && !b -> isDir())
+                         return true;
+                       else if(!a -> isDir() && b -> isDir())
+                         return false;
+                       else return func(a, b);;
+                     });
 
+    sorted_ = true;
   }
 
+  // refers to the names in filteredFileList_, rebuilt by find() after the
+  // list changed
+  struct NameKey {
+    const std::string* name;
+    int matchLine;
+
+    bool operator==(const NameKey& key) const {
+      return matchLine == key.matchLine && *name == *key.name;
+    }
+  };
+
+  struct NameKeyHash {
+    size_t operator()(const NameKey& key) const {
+      return std::hash<std::string>()(*key.name) ^ std::hash<int>()(key.matchLine);
+    }
+  };
+
   bool hidden_;
   std::string path_, filter_;
   std::vector<std::shared_ptr<FileInfo>> fileList_;
   std::vector<std::shared_ptr<FileInfo>> filteredFileList_;
+  mutable tsl::robin_map<NameKey, int, NameKeyHash> nameIndex_;
+  mutable bool nameIndexValid_;
+  bool sorted_;
   SortType sortType_;
   SortOrder sortOrder_;
   FilterType filterType_;
 };
 
-class CheckFileType {
+/*
+ * Snapshots of recently loaded directories, shared by all FileViews and the
+ * preview.
+ *
+ * A snapshot holds the entries and the name of the file under the cursor
+ * when the directory was left. Sorting and filtering are applied by the
+ * FileView that loads it. Every cached directory is watched with inotify,
+ * and a snapshot is dropped on any change in its directory (entries
+ * created, deleted, renamed, modified or chmod-ed) or when the mtime/ctime
+ * of the directory differ. The sizes of the du mode of a changed directory
+ * are invalidated too. A directory that can not be watched is not
+ * cached. The least recently used snapshots are dropped beyond
+ * MAX_DIRS directories or MAX_FILES entries in total.
+ *
+ * prefetch() loads directories in a background thread, e.g. the parent
+ * of the current directory.
+ */
+class DirCache {
 public:
-  static bool isImage(FILE* fp) {
-    fseek(fp, 0L, SEEK_SET);
-    if(ImageUtil::checkHeader(fp) != ImageUtil::IMG_TYPE::IMG_UNKNOWN) {
-      fseek(fp, 0L, SEEK_SET);
-      return true;
+  DirCache() : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), files_(0), kill_(false) {}
+
+  ~DirCache() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      kill_ = true;
+      prefetch_.clear();
     }
+    cv_.notify_all();
+    if(worker_.joinable()) worker_.join();
 
-    fseek(fp, 0L, SEEK_SET);
-    return false;
+    if(fd_ != -1) close(fd_);
   }
 
-  static bool isPDF(FILE* fp) {
-    fseek(fp, 0L, SEEK_SET);
+  // loads path into dir from the cache, or reads it and caches it.
+  // cursor is the file name of the cursor when the directory was left.
+  bool load(const std::string& path, DirInfo& dir, std::string* cursor = 0,
+            std::atomic<bool>* kill = 0) {
+    std::shared_ptr<DirInfo::Snapshot> snapshot;
+    std::string cursorName;
+    int wd = -1;
+    struct stat s;
 
-    unsigned char header[4];
-    fread(header, 1, sizeof(header), fp);
-    fseek(fp, 0L, SEEK_SET);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      readEventsNL();
+
+      auto it = findNL(path);
+      if(it != entries_.end()) {
+        if(isValid(*it)) {
+          entries_.splice(entries_.begin(), entries_, it);
+          snapshot = it -> snapshot;
+          cursorName = it -> cursor;
+        }
+        else eraseNL(it);
+      }
+
+      // watch before reading, so no change is missed
+      if(!snapshot && fd_ != -1 && stat(path.c_str(), &s) == 0) {
+        wd = inotify_add_watch(fd_, path.c_str(), IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF |
+                               IN_MOVE_SELF | IN_ONLYDIR);
+        if(wd != -1) pending_.emplace_back(wd);
+      }
+    }
+
+    if(snapshot) {
+      dir.load(path, *snapshot);
+      if(cursor != 0) *cursor = cursorName;
 
-    if(header[0] == '%' && header[1] == 'P' &&
-       header[2] == 'D' && header[3] == 'F') {
       return true;
     }
-    return false;
+
+    bool result = dir.chdir(path, kill);
+    if(cursor != 0) cursor -> clear();
+
+    if(result && wd != -1 && dir.getFileCount() <= MAX_FILES) {
+      snapshot.reset(new DirInfo::Snapshot(dir.getSnapshot()));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(wd != -1) pending_.erase(std::find(pending_.begin(), pending_.end(), wd));
+
+    if(!snapshot) {
+      removeWatchNL(wd);
+      return result;
+    }
+
+    auto it = findNL(path);
+    if(it != entries_.end()) eraseNL(it);
+
+    Entry entry;
+    entry.path = path;
+    entry.snapshot = snapshot;
+    entry.wd = wd;
+    entry.mtime = s.st_mtim;
+    entry.ctime = s.st_ctim;
+
+    files_ += entry.snapshot -> files.size();
+    entries_.emplace_front(std::move(entry));
+    shrinkNL();
+
+    // drops it if the directory has changed while it was read
+    readEventsNL();
+
+    return true;
   }
 
-  static bool isSixel(FILE* fp) {
-    fseek(fp, 0L, SEEK_SET);
+  // load path in the background if it is not cached
+  void prefetch(const std::string& path) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(kill_) return;
 
-    unsigned char header[3];
-    fread(header, 1, sizeof(header), fp);
-    fseek(fp, 0L, SEEK_SET);
+      auto it = findNL(path);
+      if(it != entries_.end() && isValid(*it)) return;
+      if(std::find(prefetch_.begin(), prefetch_.end(), path) != prefetch_.end()) return;
 
-    if(header[0] == 0x1B && header[1] == 0x50) {
-      return true;
+      prefetch_.emplace_back(path);
+      while(prefetch_.size() > MAX_PREFETCH) prefetch_.pop_front();
+
+      if(!worker_.joinable()) worker_ = std::thread(&DirCache::worker, this);
     }
-    return false;
+    cv_.notify_one();
   }
 
-  static bool isAudio(const FileInfo& fileInfo) {
-    auto suffix = fileInfo.getSuffix();
-    std::transform(suffix.begin(), suffix.end(), suffix.begin(), tolower);
+  // remember the cursor of a directory that is left
+  void setCursor(const std::string& path, const std::string& fileName) {
+    std::lock_guard<std::mutex> lock(mutex_);
 
-    if(suffix == "mp3" || suffix == "mp4" || suffix == "flac" ||
-       suffix == "wav" || suffix == "ogg" || suffix == "wv" ||
-       suffix == "tta" || suffix == "aiff" || suffix == "asf")
-      return true;
+    auto it = findNL(path);
+    if(it != entries_.end()) it -> cursor = fileName;
+  }
 
-    return false;
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearNL();
   }
 
-  static bool isArchive(FILE* fp) {
-    fseek(fp, 0L, SEEK_SET);
+private:
+  static const int MAX_DIRS = 16;
+  static const int MAX_FILES = 200000;
+  static const size_t MAX_PREFETCH = 4;
 
-    unsigned char header[280];
-    fread(header, 1, sizeof(header), fp);
-    fseek(fp, 0L, SEEK_SET);
+  struct Entry {
+    std::string path;
+    std::shared_ptr<DirInfo::Snapshot> snapshot;
+    std::string cursor;
+    int wd;
+    timespec mtime, ctime;
+  };
+
+  void worker() {
+    while(1) {
+      std::string path;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]{ return kill_ || !prefetch_.empty(); });
+        if(kill_) return;
+
+        path = prefetch_.back();
+        prefetch_.pop_back();
+
+        auto it = findNL(path);
+        if(it != entries_.end() && isValid(*it)) continue;
+      }
+
+      DirInfo dir("");
+      load(path, dir, 0, &kill_);
+    }
+  }
+
+  static bool isSameTime(const timespec& a, const timespec& b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+  }
+
+  static bool isValid(const Entry& entry) {
+    struct stat s;
+    return stat(entry.path.c_str(), &s) == 0 && isSameTime(s.st_mtim, entry.mtime) &&
+      isSameTime(s.st_ctim, entry.ctime);
+  }
+
+  std::list<Entry>::iterator findNL(const std::string& path) {
+    return std::find_if(entries_.begin(), entries_.end(),
+                        [&path](const Entry& e) { return e.path == path; });
+  }
+
+  void clearNL() {
+    while(!entries_.empty()) eraseNL(entries_.begin());
+  }
+
+  void eraseNL(std::list<Entry>::iterator it) {
+    auto wd = it -> wd;
+    files_ -= it -> snapshot -> files.size();
+    entries_.erase(it);
+
+    removeWatchNL(wd);
+  }
+
+  void eraseWatchNL(int wd) {
+    for(auto it = entries_.begin(); it != entries_.end();) {
+      if(it -> wd == wd) {
+        // a file in it may have grown without changing the mtime
+        dirSizeCalculator.invalidate(it -> path);
+        files_ -= it -> snapshot -> files.size();
+        it = entries_.erase(it);
+      }
+      else ++it;
+    }
+  }
+
+  // the same directory may be cached by another path (symlink) or be read
+  // by another thread
+  void removeWatchNL(int wd) {
+    if(wd == -1) return;
+    if(std::find(pending_.begin(), pending_.end(), wd) != pending_.end()) return;
+    if(std::none_of(entries_.begin(), entries_.end(),
+                    [wd](const Entry& e) { return e.wd == wd; })) {
+      inotify_rm_watch(fd_, wd);
+    }
+  }
+
+  void shrinkNL() {
+    while(static_cast<int>(entries_.size()) > MAX_DIRS || (files_ > MAX_FILES && entries_.size() > 1)) {
+      eraseNL(std::prev(entries_.end()));
+    }
+  }
+
+  void readEventsNL() {
+    if(fd_ == -1) return;
+
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while((len = read(fd_, buf, sizeof(buf))) > 0) {
+      for(char* p = buf; p < buf + len;) {
+        auto event = reinterpret_cast<const struct inotify_event*>(p);
+
+        if(event -> mask & IN_Q_OVERFLOW) clearNL();
+        else if(!(event -> mask & IN_IGNORED)) {
+          eraseWatchNL(event -> wd);
+          removeWatchNL(event -> wd);
+        }
+        p += sizeof(struct inotify_event) + event -> len;
+      }
+    }
+  }
+
+  int fd_;
+  long files_;
+  std::list<Entry> entries_;
+  std::vector<int> pending_;
+
+  std::atomic<bool> kill_;
+  std::deque<std::string> prefetch_;
+  std::thread worker_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+DirCache dirCache;
+
+/*
+ * Recursive file name search under root.
+ *
+ * Directories are read by a pool of worker threads and the matching names
+ * (relative to root) are collected for getResults(). Other mounted
+ * filesystems and symlinked directories are not entered.
+ *
+ * With SearchIndex the names of every directory are saved in
+ * ~/.cache/Minase/index/ together with the directory mtime. The next search
+ * under the same root only stats the directories and reads the ones whose
+ * mtime has changed.
+ */
+class FileSearch {
+public:
+  FileSearch(const std::string& root, const std::string& filter,
+             DirInfo::FilterType type, bool hidden) :
+    root_(root), filter_(DirInfo::createFilter(filter, type)), hidden_(hidden),
+    useIndex_(config.useSearchIndex()), kill_(false), done_(false), active_(0), rootDev_(0) {
+
+    struct stat st;
+    if(lstat(root_.c_str(), &st) != 0) {
+      done_ = true;
+      return;
+    }
+    rootDev_ = st.st_dev;
+    if(root_.back() != '/') root_ += '/';
+
+    if(useIndex_) loadIndex();
+
+    stack_.emplace_back(Item{"", false});
 
+    int n = std::thread::hardware_concurrency();
+    n = std::max(2, std::min(n, 8));
+    for(int i = 0; i < n; ++i)
+      workers_.emplace_back(&FileSearch::worker, this);
+  }
+
+  ~FileSearch() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      kill_ = true;
+    }
+    cv_.notify_all();
+
+    for(auto&& t: workers_) {
+      if(t.joinable()) t.join();
+    }
+  }
+
+  bool isDone() const { return done_; }
+  std::string getRoot() const { return root_; }
+
+  // take the names found since the last call
+  bool getResults(std::vector<std::string>& results) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(results_.empty()) return false;
+
+    results.swap(results_);
+    results_.clear();
+
+    return true;
+  }
+
+private:
+  struct Item {
+    std::string rel;
+    bool hidden;
+  };
+
+  struct Entry {
+    std::string name;
+    bool dir;
+  };
+
+  struct DirRecord {
+    int64_t mtimeSec, mtimeNsec;
+    std::vector<Entry> entries;
+  };
+
+  void worker() {
+    while(1) {
+      Item item;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return kill_ || !stack_.empty() || active_ == 0; });
+        if(kill_) return;
+        if(stack_.empty()) {
+          if(!done_) {
+            done_ = true;
+            if(useIndex_) saveIndex();
+          }
+          cv_.notify_all();
+          return;
+        }
+
+        item = stack_.back();
+        stack_.pop_back();
+        ++active_;
+      }
+
+      scan(item);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --active_;
+      }
+      cv_.notify_all();
+    }
+  }
+
+  void scan(const Item& item) {
+    auto path = root_ + item.rel;
+
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0 || st.st_dev != rootDev_) return;
+
+    DirRecord record;
+    record.mtimeSec = st.st_mtim.tv_sec;
+    record.mtimeNsec = st.st_mtim.tv_nsec;
+
+    bool cached = false;
+    if(useIndex_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(item.rel);
+      if(it != index_.end() && it -> second.mtimeSec == record.mtimeSec &&
+         it -> second.mtimeNsec == record.mtimeNsec) {
+        record.entries = it -> second.entries;
+        cached = true;
+      }
+    }
+
+    if(!cached) {
+      auto dir = opendir(path.c_str());
+      if(dir == NULL) return;
+
+      int fd = dirfd(dir);
+      struct dirent* dp;
+      while((dp = readdir(dir)) != NULL) {
+        if((dp -> d_name[0] == '.' && (dp -> d_name[1] == 0 || (dp -> d_name[1] == '.' && dp -> d_name[2] == 0))))
+          continue;
+        if(kill_) break;
+
+        bool isDir = dp -> d_type == DT_DIR;
+        if(dp -> d_type == DT_UNKNOWN) {
+          struct stat s;
+          isDir = fstatat(fd, dp -> d_name, &s, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(s.st_mode);
+        }
+
+        record.entries.emplace_back(Entry{dp -> d_name, isDir});
+      }
+      closedir(dir);
+
+      if(kill_) return;
+    }
+
+    std::vector<std::string> matches;
+    std::vector<Item> dirs;
+    for(const auto& e: record.entries) {
+      bool hidden = item.hidden || (e.name[0] == '.' && !hidden_);
+
+      if(!hidden && filter_ -> isMatch(e.name))
+        matches.emplace_back(item.rel + e.name);
+
+      // hidden directories are only needed for a complete index
+      if(e.dir && (!hidden || useIndex_))
+        dirs.emplace_back(Item{item.rel + e.name + "/", hidden});
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto&& m: matches) results_.emplace_back(std::move(m));
+    for(auto&& d: dirs) stack_.emplace_back(std::move(d));
+    if(useIndex_) newIndex_[item.rel] = std::move(record);
+    if(!dirs.empty()) cv_.notify_all();
+  }
+
+  std::string getIndexFileName() const {
+    auto home = getenv("HOME");
+    if(home == 0) return "";
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016llx",
+             static_cast<unsigned long long>(std::hash<std::string>()(root_)));
+
+    return std::string(home) + "/.cache/Minase/index/" + buf;
+  }
+
+  static bool readString(FILE* fp, std::string& str) {
+    uint32_t len;
+    if(fread(&len, sizeof(len), 1, fp) != 1) return false;
+
+    str.resize(len);
+    return len == 0 || fread(&str[0], 1, len, fp) == len;
+  }
+
+  static void writeString(FILE* fp, const std::string& str) {
+    uint32_t len = str.length();
+    fwrite(&len, sizeof(len), 1, fp);
+    fwrite(str.data(), 1, len, fp);
+  }
+
+  void loadIndex() {
+    auto fileName = getIndexFileName();
+    if(fileName.empty()) return;
+
+    FILE* fp;
+    if((fp = fopen(fileName.c_str(), "rb")) == NULL) return;
+
+    std::string root;
+    if(readString(fp, root) && root == root_) {
+      std::string rel;
+      while(readString(fp, rel)) {
+        DirRecord record;
+        uint32_t count;
+
+        if(fread(&record.mtimeSec, sizeof(int64_t), 1, fp) != 1 ||
+           fread(&record.mtimeNsec, sizeof(int64_t), 1, fp) != 1 ||
+           fread(&count, sizeof(count), 1, fp) != 1) break;
+
+        bool ok = true;
+        for(uint32_t i = 0; i < count && ok; ++i) {
+          Entry e;
+          ok = readString(fp, e.name) && fread(&e.dir, sizeof(bool), 1, fp) == 1;
+          record.entries.emplace_back(e);
+        }
+        if(!ok) break;
+
+        index_[rel] = std::move(record);
+      }
+    }
+
+    fclose(fp);
+  }
+
+  void saveIndex() {
+    auto fileName = getIndexFileName();
+    if(fileName.empty()) return;
+
+    auto dir = getDirName(fileName);
+    mkdir(getDirName(getDirName(dir)).c_str(), 0755);
+    mkdir(getDirName(dir).c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+
+    auto tmp = fileName + "." + std::to_string(getpid());
+    FILE* fp;
+    if((fp = fopen(tmp.c_str(), "wb")) == NULL) return;
+
+    writeString(fp, root_);
+    for(const auto& r: newIndex_) {
+      uint32_t count = r.second.entries.size();
+
+      writeString(fp, r.first);
+      fwrite(&r.second.mtimeSec, sizeof(int64_t), 1, fp);
+      fwrite(&r.second.mtimeNsec, sizeof(int64_t), 1, fp);
+      fwrite(&count, sizeof(count), 1, fp);
+      for(const auto& e: r.second.entries) {
+        writeString(fp, e.name);
+        fwrite(&e.dir, sizeof(bool), 1, fp);
+      }
+    }
+
+    bool ok = !ferror(fp);
+    if(fclose(fp) == 0 && ok) rename(tmp.c_str(), fileName.c_str());
+    else unlink(tmp.c_str());
+  }
+
+  std::string root_;
+  std::shared_ptr<DirInfo::Filter> filter_;
+  bool hidden_, useIndex_;
+  std::atomic<bool> kill_, done_;
+  int active_;
+  dev_t rootDev_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+  std::vector<Item> stack_;
+  std::vector<std::string> results_;
+  tsl::robin_map<std::string, DirRecord> index_, newIndex_;
+};
+
+class CheckFileType {
+public:
+  enum Type {
+    UNREADABLE,
+    EMPTY,
+    IMAGE,
+    PDF,
+    SIXEL,
+    ARCHIVE,
+    ELF,
+    BINARY,
+    TEXT,
+  };
+
+  // classifies a file by its first HEAD_SIZE and last TAIL_SIZE bytes,
+  // read with one pread() each. maxBytes: read only the first maxBytes
+  // bytes, 0: no limit
+  static Type classify(const std::string& path, long maxBytes = 0) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return Type::UNREADABLE;
+
+    size_t readSize = maxBytes > 0 ? std::min<long>(HEAD_SIZE, maxBytes) : HEAD_SIZE;
+    unsigned char head[HEAD_SIZE] = {0}, tail[TAIL_SIZE];
+    ssize_t headSize = pread(fd, head, readSize, 0), tailSize = 0;
+
+    struct stat s;
+    if(maxBytes == 0 && headSize == HEAD_SIZE && fstat(fd, &s) == 0 && s.st_size > HEAD_SIZE) {
+      auto offset = std::max<off_t>(HEAD_SIZE, s.st_size - TAIL_SIZE);
+      tailSize = pread(fd, tail, s.st_size - offset, offset);
+      if(tailSize < 0) tailSize = 0;
+    }
+    close(fd);
+
+    if(headSize < 0) return Type::UNREADABLE;
+
+    return classify(head, headSize, tail, tailSize);
+  }
+
+  // head has to be readable for MAGIC_SIZE bytes, zero-filled past the end
+  // of the file
+  static Type classify(const unsigned char* head, size_t headSize,
+                       const unsigned char* tail, size_t tailSize) {
+    if(headSize == 0) return Type::EMPTY;
+
+    if(ImageUtil::checkHeader(head) != ImageUtil::IMG_TYPE::IMG_UNKNOWN) return Type::IMAGE;
+    if(isArchive(head)) return Type::ARCHIVE;
+    if(isPDF(head)) return Type::PDF;
+    if(isSixel(head)) return Type::SIXEL;
+    if(head[0] == 0x7F && head[1] == 'E' && head[2] == 'L' && head[3] == 'F') return Type::ELF;
+    if(isUtf16(head)) return Type::TEXT;
+
+    // any NUL, or more than 1/32 of other control characters
+    auto h = sniff(head, headSize, true), t = sniff(tail, tailSize, true);
+    if(h.nul + t.nul > 0) return Type::BINARY;
+    if((h.ctrl + t.ctrl) * 32 > headSize + tailSize) return Type::BINARY;
+
+    return Type::TEXT;
+  }
+
+  static bool isAudio(const FileInfo& fileInfo) {
+    auto type = fileInfo.getSuffixType();
+    return type != 0 && type -> audio;
+  }
+
+  // header: the first 280 bytes of the file, zero-filled if it is shorter
+  static bool isArchive(const unsigned char* header) {
     // .gz
     if(header[0] == 0x1F && header[1] == 0x8B && header[2] == 0x08) {
       return true;
@@ -1073,63 +2585,495 @@ public:
     return false;
   }
 
-  static bool isBinary(FILE* fp) {
-    fseek(fp, 0L, SEEK_SET);
-    if(fgetc(fp) == EOF) return true;
+  // classify() for a file that is already in memory (e.g. mmap'd)
+  static bool isBinary(const char* buf, size_t size) {
+    auto p = reinterpret_cast<const unsigned char*>(buf);
+    auto headSize = std::min<size_t>(size, HEAD_SIZE);
+    auto tailSize = size > HEAD_SIZE ? std::min<size_t>(size - HEAD_SIZE, TAIL_SIZE) : 0;
 
-    fseek(fp, 0L, SEEK_SET);
-    if(isPDF(fp)) return true;
-    if(isSixel(fp)) return true;
+    unsigned char magic[MAGIC_SIZE] = {0};
+    const unsigned char* head = p;
+    if(size < MAGIC_SIZE) {
+      memcpy(magic, p, size);
+      head = magic;
+    }
 
-    fseek(fp, 0L, SEEK_SET);
-    int cnt = 0;
-    while(feof(fp) == 0) {
-      auto c = fgetc(fp);
+    return classify(head, headSize, p + size - tailSize, tailSize) != Type::TEXT;
+  }
 
-      if(c == EOF) {
-        fseek(fp, 0L, SEEK_SET);
-        return false;
+  // result of one pass over a buffer
+  struct Sniff {
+    size_t nul;   // NUL bytes
+    size_t ctrl;  // control characters other than \t\n\v\f\r and ESC
+    bool ascii;   // no byte >= 0x80
+    bool utf8;    // valid UTF-8
+  };
+
+  // a sequence cut by either end of the buffer is not invalid if partial
+  // is true. 16 bytes at a time with SSE2 while they are ASCII.
+  static Sniff sniff(const unsigned char* p, size_t size, bool partial = false) {
+    Sniff result = {0, 0, true, true};
+    size_t i = 0;
+
+    if(partial) {
+      while(i < size && i < 3 && (p[i] & 0xC0) == 0x80) ++i;
+    }
+
+    while(i < size) {
+#ifdef __SSE2__
+      const auto space = _mm_set1_epi8(0x20);
+      while(i + 16 <= size) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        int high = _mm_movemask_epi8(v);
+        int n = high ? __builtin_ctz(high) : 16;
+
+        // bytes < 0x20 before the first non-ASCII byte
+        int low = _mm_movemask_epi8(_mm_cmplt_epi8(v, space)) & ((1 << n) - 1);
+        for(; low; low &= low - 1) countCtrl(p[i + __builtin_ctz(low)], result);
+
+        i += n;
+        if(high) break;
       }
-      if(c <= 0x08) {
-        fseek(fp, 0L, SEEK_SET);
-        return true;
+      if(i >= size) break;
+#endif
+
+      auto c = p[i];
+      if(c < 0x80) {
+        countCtrl(c, result);
+        ++i;
+        continue;
+      }
+
+      result.ascii = false;
+      auto n = getUtf8Length(p + i, size - i);
+      if(n > 0) i += n;
+      else if(n == 0 && partial) break;
+      else {
+        result.utf8 = false;
+        ++i;
       }
-      if(++cnt > 512) break;
     }
 
-    cnt = 0;
-    fseek(fp, -512L, SEEK_END);
-    while(feof(fp) == 0) {
-      auto c = fgetc(fp);
+    return result;
+  }
+
+  // byte order mark of UTF-16
+  static bool isUtf16(const unsigned char* header) {
+    return (header[0] == 0xFF && header[1] == 0xFE) || (header[0] == 0xFE && header[1] == 0xFF);
+  }
 
-      if(c == EOF) {
-        break;
+private:
+  static const int HEAD_SIZE = 64 * 1024;
+  static const int TAIL_SIZE = 4096;
+  static const int MAGIC_SIZE = 512;
+
+  static bool isPDF(const unsigned char* header) {
+    return header[0] == '%' && header[1] == 'P' && header[2] == 'D' && header[3] == 'F';
+  }
+
+  static bool isSixel(const unsigned char* header) {
+    return header[0] == 0x1B && header[1] == 0x50;
+  }
+
+  static void countCtrl(unsigned char c, Sniff& sniff) {
+    // \t \n \v \f \r ESC
+    const uint32_t TEXT_CTRL = 0x3E00 | (1u << 0x1B);
+
+    if(c == 0) ++sniff.nul;
+    else if(c < 0x20 && !(TEXT_CTRL & (1u << c))) ++sniff.ctrl;
+  }
+
+  // length of the UTF-8 sequence at p, 0: cut by the end, -1: invalid
+  static int getUtf8Length(const unsigned char* p, size_t size) {
+    unsigned char lo = 0x80, hi = 0xBF;
+    int n;
+
+    if(p[0] >= 0xC2 && p[0] <= 0xDF) n = 2;
+    else if(p[0] >= 0xE0 && p[0] <= 0xEF) {
+      n = 3;
+      if(p[0] == 0xE0) lo = 0xA0;
+      else if(p[0] == 0xED) hi = 0x9F;
+    }
+    else if(p[0] >= 0xF0 && p[0] <= 0xF4) {
+      n = 4;
+      if(p[0] == 0xF0) lo = 0x90;
+      else if(p[0] == 0xF4) hi = 0x8F;
+    }
+    else return -1;
+
+    for(int i = 1; i < n; ++i) {
+      if(static_cast<size_t>(i) >= size) return 0;
+      if(p[i] < lo || p[i] > hi) return -1;
+      lo = 0x80, hi = 0xBF;
+    }
+
+    return n;
+  }
+};
+
+/*
+ * Recursive content search (grep mode) under root.
+ *
+ * Files are mmap'd and searched by a pool of worker threads. The longest
+ * literal that every match has to contain is looked up with memmem() first
+ * and only the lines containing it are passed to regexec(). Binary files
+ * (CheckFileType::isBinary) are skipped.
+ */
+class ContentSearch {
+public:
+  struct Match {
+    std::string name;
+    int line;
+    std::string text;
+  };
+
+  ContentSearch(const std::string& root, const std::string& pattern, bool hidden) :
+    root_(root), hidden_(hidden), valid_(false), reg_(false), literalOnly_(false), rarePos_(0),
+    kill_(false), done_(true), truncated_(false), active_(0), count_(0), rootDev_(0) {
+
+    struct stat st;
+    if(pattern.empty() || lstat(root_.c_str(), &st) != 0) return;
+    rootDev_ = st.st_dev;
+    if(root_.back() != '/') root_ += '/';
+
+    getLiteral(pattern);
+    if(!literalOnly_) {
+      if(regcomp(&re_, pattern.c_str(), REG_EXTENDED|REG_NEWLINE|REG_NOSUB) != 0) return;
+      reg_ = true;
+    }
+
+    valid_ = true;
+    done_ = false;
+    stack_.emplace_back(Item{"", true});
+
+    int n = std::thread::hardware_concurrency();
+    n = std::max(2, std::min(n, 8));
+    for(int i = 0; i < n; ++i)
+      workers_.emplace_back(&ContentSearch::worker, this);
+  }
+
+  ~ContentSearch() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      kill_ = true;
+    }
+    cv_.notify_all();
+
+    for(auto&& t: workers_) {
+      if(t.joinable()) t.join();
+    }
+
+    if(reg_) regfree(&re_);
+  }
+
+  bool isValid() const { return valid_; }
+  bool isDone() const { return done_; }
+  bool isTruncated() const { return truncated_; }
+
+  // take the matches found since the last call
+  bool getResults(std::vector<Match>& results) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(results_.empty()) return false;
+
+    results.swap(results_);
+    results_.clear();
+
+    return true;
+  }
+
+private:
+  static const int MAX_MATCHES = 10000;
+  static const int MAX_FILE_MATCHES = 1000;
+  static const int MAX_TEXT_LENGTH = 256;
+
+  struct Item {
+    std::string rel;
+    bool dir;
+  };
+
+  /*
+   * Find the longest run of plain characters in an extended regexp that
+   * every match must contain. Alternation and groups are not analysed;
+   * such patterns are searched without a prefilter.
+   */
+  void getLiteral(const std::string& pattern) {
+    std::string cur;
+    bool plain = false;
+    literalOnly_ = true;
+
+    auto endRun = [&]() {
+      if(cur.length() > literal_.length()) literal_ = cur;
+      cur.clear();
+      literalOnly_ = false;
+    };
+
+    auto noLiteral = [&]() {
+      literal_.clear();
+      literalOnly_ = false;
+    };
+
+    for(size_t i = 0; i < pattern.length(); ++i) {
+      auto c = pattern[i];
+
+      if(c == '|' || c == '(' || c == ')') return noLiteral();
+      else if(c == '*' || c == '?' || c == '{') {
+        // the previous character may not be there
+        if(plain) cur.pop_back();
+        endRun();
+
+        if(c == '{') {
+          auto end = pattern.find('}', i);
+          if(end == std::string::npos) return noLiteral();
+          i = end;
+        }
+        plain = false;
+        continue;
       }
-      if(c <= 0x08) {
-        fseek(fp, 0L, SEEK_SET);
-        return true;
+      else if(c == '\\') {
+        if(++i == pattern.length()) return noLiteral();
+
+        if(strchr(".[]()*+?{}|^$\\/", pattern[i]) != 0) {
+          cur += pattern[i];
+          plain = true;
+        }
+        else {
+          endRun();
+          plain = false;
+        }
+        continue;
+      }
+      else if(c == '[') {
+        auto end = i + 1;
+        if(end < pattern.length() && pattern[end] == '^') ++end;
+        if(end < pattern.length() && pattern[end] == ']') ++end;
+        end = pattern.find(']', end);
+        if(end == std::string::npos) return noLiteral();
+        i = end;
+
+        endRun();
+        plain = false;
+        continue;
+      }
+      else if(c == '.' || c == '^' || c == '$' || c == '+') {
+        endRun();
+        plain = false;
+        continue;
       }
-      if(++cnt > 512) break;
+
+      cur += c;
+      plain = true;
     }
 
-    fseek(fp, 0L, SEEK_SET);
-    return false;
+    if(cur.length() > literal_.length()) literal_ = cur;
+    if(literal_.empty()) literalOnly_ = false;
+
+    // memchr() for the least common character of the literal, then compare
+    // the rest. This is faster than memmem() on source code and text.
+    static const char common[] = " etaoinsrlcdhupmf_.,;()\n\t";
+    size_t rank = 0;
+    rarePos_ = 0;
+    for(size_t i = 0; i < literal_.length(); ++i) {
+      auto p = strchr(common, literal_[i]);
+      size_t r = p == 0 ? sizeof(common) : p - common;
+      if(r > rank) {
+        rank = r;
+        rarePos_ = i;
+      }
+    }
+  }
+
+  const char* findLiteral(const char* begin, const char* end) const {
+    auto len = literal_.length();
+    auto rare = literal_[rarePos_];
+    auto p = begin + rarePos_;
+
+    while(p < end && static_cast<size_t>(end - p) >= len - rarePos_) {
+      p = static_cast<const char*>(memchr(p, rare, end - p - (len - rarePos_) + 1));
+      if(p == 0) return 0;
+
+      if(memcmp(p - rarePos_, literal_.data(), len) == 0) return p - rarePos_;
+      ++p;
+    }
+
+    return 0;
+  }
+
+  void worker() {
+    while(1) {
+      Item item;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return kill_ || !stack_.empty() || active_ == 0; });
+        if(kill_) return;
+        if(stack_.empty()) {
+          done_ = true;
+          cv_.notify_all();
+          return;
+        }
+
+        item = stack_.back();
+        stack_.pop_back();
+        ++active_;
+      }
+
+      if(item.dir) scanDir(item.rel);
+      else searchFile(item.rel);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --active_;
+      }
+      cv_.notify_all();
+    }
+  }
+
+  void scanDir(const std::string& rel) {
+    auto path = root_ + rel;
+
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0 || st.st_dev != rootDev_) return;
+
+    auto dir = opendir(path.c_str());
+    if(dir == NULL) return;
+
+    std::vector<Item> items;
+    int fd = dirfd(dir);
+    struct dirent* dp;
+    while((dp = readdir(dir)) != NULL) {
+      if((dp -> d_name[0] == '.' && (dp -> d_name[1] == 0 || (dp -> d_name[1] == '.' && dp -> d_name[2] == 0))))
+        continue;
+      if(dp -> d_name[0] == '.' && !hidden_) continue;
+      if(kill_) break;
+
+      auto type = dp -> d_type;
+      if(type == DT_UNKNOWN) {
+        struct stat s;
+        if(fstatat(fd, dp -> d_name, &s, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        type = S_ISDIR(s.st_mode) ? DT_DIR : S_ISREG(s.st_mode) ? DT_REG : DT_UNKNOWN;
+      }
+
+      if(type == DT_DIR) items.emplace_back(Item{rel + dp -> d_name + "/", true});
+      else if(type == DT_REG) items.emplace_back(Item{rel + dp -> d_name, false});
+    }
+    closedir(dir);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto&& i: items) stack_.emplace_back(std::move(i));
+    if(!items.empty()) cv_.notify_all();
   }
+
+  void searchFile(const std::string& rel) {
+    int fd = open((root_ + rel).c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+      close(fd);
+      return;
+    }
+
+    size_t size = st.st_size;
+    auto addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) return;
+
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    auto begin = static_cast<const char*>(addr);
+    auto end = begin + size;
+
+    std::vector<Match> matches;
+    if(!CheckFileType::isBinary(begin, size)) {
+      auto cur = begin, counted = begin;
+      int line = 1;
+      std::string buf;
+
+      while(cur < end && !kill_) {
+        auto hit = cur;
+        if(!literal_.empty()) {
+          hit = findLiteral(cur, end);
+          if(hit == 0) break;
+        }
+
+        auto lineBegin = hit;
+        while(lineBegin > cur && lineBegin[-1] != '\n') --lineBegin;
+        auto lineEnd = static_cast<const char*>(memchr(hit, '\n', end - hit));
+        if(lineEnd == 0) lineEnd = end;
+
+        line += std::count(counted, lineBegin, '\n');
+        counted = lineBegin;
+
+        bool match = literalOnly_;
+        if(!match) {
+          buf.assign(lineBegin, lineEnd);
+          match = regexec(&re_, buf.c_str(), 0, 0, 0) == 0;
+        }
+
+        if(match) {
+          matches.emplace_back(Match{rel, line, getMatchText(lineBegin, lineEnd)});
+          if(matches.size() >= MAX_FILE_MATCHES) break;
+        }
+
+        cur = lineEnd + 1;
+      }
+    }
+    munmap(addr, size);
+
+    if(matches.empty()) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(count_ >= MAX_MATCHES) return;
+
+    count_ += matches.size();
+    for(auto&& m: matches) results_.emplace_back(std::move(m));
+
+    if(count_ >= MAX_MATCHES) {
+      truncated_ = true;
+      stack_.clear();
+    }
+  }
+
+  // the line for the result list: leading blanks removed, tabs and control
+  // characters replaced, cut at a UTF-8 character boundary
+  static std::string getMatchText(const char* begin, const char* end) {
+    while(begin < end && (*begin == ' ' || *begin == '\t')) ++begin;
+    if(end - begin > MAX_TEXT_LENGTH) {
+      end = begin + MAX_TEXT_LENGTH;
+      while(end > begin && (*end & 0xC0) == 0x80) --end;
+    }
+
+    std::string text(begin, end);
+    for(auto&& c: text) {
+      if(static_cast<unsigned char>(c) < 0x20 || c == 0x7f) c = ' ';
+    }
+
+    return text;
+  }
+
+  std::string root_;
+  bool hidden_, valid_, reg_, literalOnly_;
+  std::string literal_;
+  size_t rarePos_;
+  regex_t re_;
+  std::atomic<bool> kill_, done_, truncated_;
+  int active_, count_;
+  dev_t rootDev_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+  std::vector<Item> stack_;
+  std::vector<Match> results_;
 };
 
-static std::string getIcon(const FileInfo& fileinfo)
+static const char* getIcon(const FileInfo& fileinfo)
 {
-  std::string ret;
-
   if(fileinfo.isDir()) {
     return dirIcon.icon;
   }
   else {
-    for(size_t i = 0; i < sizeof(icons)/sizeof(icons[0]); ++i) {
-      auto suffix = fileinfo.getSuffix();
-      std::transform(suffix.cbegin(), suffix.cend(), suffix.begin(), tolower);
-      if(suffix == icons[i].match) return icons[i].icon;
-    }
+    auto type = fileinfo.getSuffixType();
+    if(type != 0 && type -> icon != 0) return type -> icon;
 
     if(fileinfo.isExe()) {
       return exeIcon.icon;
@@ -1138,15 +3082,240 @@ static std::string getIcon(const FileInfo& fileinfo)
       return fileIcon.icon;
     }
   }
+}
+
+static const char* const SIXEL_CACHE_MAGIC = "MNSIXEL1";
+
+/*
+ * Sixel images of the preview in ~/.cache/Minase/sixel/, keyed by the
+ * dev/ino/size/mtime of the image and the size of the pane.
+ *
+ * A file is written to a temporary name and renamed, so readers never see
+ * a partial file and several Minase instances can share the cache. A hit
+ * touches the mtime of the file. When the cache grows past the size of
+ * config.getSixelCacheSize(), the files with the oldest mtime are removed
+ * by the instance holding the flock of the lock file.
+ */
+class SixelCache {
+public:
+  SixelCache() : written_(-1) {}
+
+  bool load(FILE* fp, int w, int h, std::string& data) {
+    Key key;
+    if(!getKey(fp, w, h, key)) return false;
+
+    auto fileName = getFileName(key);
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return false;
+
+    char magic[8];
+    Key fileKey;
+    struct stat s;
+    bool ok = fstat(fd, &s) == 0 && s.st_size > static_cast<off_t>(sizeof(magic) + sizeof(fileKey)) &&
+      ::read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+      memcmp(magic, SIXEL_CACHE_MAGIC, sizeof(magic)) == 0 &&
+      ::read(fd, &fileKey, sizeof(fileKey)) == sizeof(fileKey) &&
+      memcmp(&fileKey, &key, sizeof(key)) == 0;
+
+    if(ok) {
+      data.resize(s.st_size - sizeof(magic) - sizeof(fileKey));
+      ok = readAll(fd, &data[0], data.size());
+    }
+    close(fd);
+
+    // least recently used by mtime
+    if(ok) utimensat(AT_FDCWD, fileName.c_str(), NULL, 0);
+
+    return ok;
+  }
+
+  void store(FILE* fp, int w, int h, const std::string& data) {
+    Key key;
+    if(!getKey(fp, w, h, key)) return;
+
+    auto dir = getCacheDir();
+    if(dir.empty()) return;
+    mkdir(getDirName(getDirName(dir)).c_str(), 0755);
+    mkdir(getDirName(dir).c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+
+    auto fileName = getFileName(key);
+    char tid[32];
+    snprintf(tid, sizeof(tid), ".%d.%zx", getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+    auto tmp = fileName + tid;
+
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1) return;
+
+    bool ok = writeAll(fd, SIXEL_CACHE_MAGIC, 8) && writeAll(fd, &key, sizeof(key)) &&
+      writeAll(fd, data.data(), data.size());
+
+    if(close(fd) == 0 && ok) rename(tmp.c_str(), fileName.c_str());
+    else unlink(tmp.c_str());
+
+    // the first store of a session and then every 1/16 of the limit
+    long limit = config.getSixelCacheSize() * 1024 * 1024;
+    if(written_ < 0 || (written_ += data.size()) > limit / 16) {
+      written_ = 0;
+      shrink(limit);
+    }
+  }
+
+private:
+  struct Key {
+    uint64_t dev, ino, size, mtimeSec, mtimeNsec, w, h;
+  };
+
+  static bool getKey(FILE* fp, int w, int h, Key& key) {
+    struct stat s;
+    if(config.getSixelCacheSize() <= 0 || fstat(fileno(fp), &s) != 0) return false;
+
+    memset(&key, 0, sizeof(key));
+    key.dev = s.st_dev;
+    key.ino = s.st_ino;
+    key.size = s.st_size;
+    key.mtimeSec = s.st_mtim.tv_sec;
+    key.mtimeNsec = s.st_mtim.tv_nsec;
+    key.w = w;
+    key.h = h;
+
+    return true;
+  }
+
+  static std::string getCacheDir() {
+    auto home = getenv("HOME");
+    if(home == 0) return "";
+
+    return std::string(home) + "/.cache/Minase/sixel";
+  }
+
+  static std::string getFileName(const Key& key) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    auto p = reinterpret_cast<const unsigned char*>(&key);
+    for(size_t i = 0; i < sizeof(key); ++i) hash = (hash ^ p[i]) * 1099511628211ULL;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/%016llx", static_cast<unsigned long long>(hash));
+
+    return getCacheDir() + buf;
+  }
+
+  static bool readAll(int fd, char* buf, size_t len) {
+    while(len > 0) {
+      auto r = ::read(fd, buf, len);
+      if(r < 0 && errno == EINTR) continue;
+      if(r <= 0) return false;
+
+      buf += r;
+      len -= r;
+    }
+
+    return true;
+  }
+
+  static bool writeAll(int fd, const void* buf, size_t len) {
+    auto p = static_cast<const char*>(buf);
+
+    while(len > 0) {
+      auto r = ::write(fd, p, len);
+      if(r < 0 && errno == EINTR) continue;
+      if(r <= 0) return false;
+
+      p += r;
+      len -= r;
+    }
+
+    return true;
+  }
+
+  // removes the least recently used files down to 3/4 of limit
+  static void shrink(long limit) {
+    auto dir = getCacheDir();
+    int lockFd = open((dir + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(lockFd == -1) return;
+
+    // another instance is already shrinking it
+    if(flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+      close(lockFd);
+      return;
+    }
+
+    struct File {
+      std::string name;
+      timespec mtime;
+      off_t size;
+    };
+    std::vector<File> files;
+    long total = 0;
+
+    auto dp = opendir(dir.c_str());
+    if(dp != NULL) {
+      struct dirent* ent;
+      time_t now = time(NULL);
+
+      while((ent = readdir(dp)) != NULL) {
+        // the cache files and the <hash>.<pid>.<tid> temporary files
+        auto len = strlen(ent -> d_name);
+        if(len < 16 || (len > 16 && ent -> d_name[16] != '.')) continue;
+
+        struct stat s;
+        auto name = dir + "/" + ent -> d_name;
+        if(lstat(name.c_str(), &s) != 0 || !S_ISREG(s.st_mode)) continue;
+
+        if(len > 16) {
+          // left by a crash or a full disk if it is not written for a minute
+          if(now - s.st_mtim.tv_sec > 60) {
+            unlink(name.c_str());
+            continue;
+          }
+        }
+        else files.emplace_back(File{name, s.st_mtim, s.st_size});
+
+        total += s.st_size;
+      }
+      closedir(dp);
+    }
+
+    if(total > limit) {
+      std::sort(files.begin(), files.end(), [](const File& a, const File& b) {
+          return a.mtime.tv_sec != b.mtime.tv_sec ?
+            a.mtime.tv_sec < b.mtime.tv_sec : a.mtime.tv_nsec < b.mtime.tv_nsec;
+        });
+
+      for(auto it = files.begin(); it != files.end() && total > limit / 4 * 3; ++it) {
+        if(unlink(it -> name.c_str()) == 0) total -= it -> size;
+      }
+    }
+
+    close(lockFd);
+  }
+
+  std::atomic<long> written_;
+};
+SixelCache sixelCache;
+
+void getTermSize(int* col, int* row, int* xpixel, int* ypixel) {
+  struct winsize ws;
+
+  // get terminal size
+  if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != -1) {
+    *col = ws.ws_col; // width
+    *row = ws.ws_row; // height
+    *xpixel = ws.ws_xpixel;
+    *ypixel = ws.ws_ypixel;
+
+    return;
+  }
 
-  return ret;
+  *col = *row = *xpixel = *ypixel = -1;
 }
 
 class PreView {
 public:
   PreView(const FileInfo& fileInfo) :
     kill_(false), done_(true), pid_(0), disable_(false), drawLoading_(false),
-    imagePreview_(true), x_(0), y_(0), width_(0), height_(0), scroll_(0),
+    imagePreview_(true), sixelShown_(false), x_(0), y_(0), width_(0), height_(0), scroll_(0),
     fileInfo_(fileInfo) {
 
     highlight_.loadPathNanoRC(config.getNanorcPath());
@@ -1178,6 +3347,11 @@ public:
     return fileInfo_.getFileName();
   }
 
+  bool isLoadFile(const FileInfo& fileInfo) const {
+    return fileInfo_.getFileName() == fileInfo.getFileName() &&
+      fileInfo_.getMatchLine() == fileInfo.getMatchLine();
+  }
+
   void cancel() {
     if(!done_) {
       while(!done_) {
@@ -1255,50 +3429,50 @@ public:
     return dest;
   }
 
-  bool draw() {
+  // draws the preview into the termbox back buffer. a sixel image is sent
+  // with the next tb_present() if redrawImage is true or it is not on the
+  // screen yet.
+  bool draw(bool redrawImage = true) {
     if(isDisable()) {
       clear();
-      printf("\e[%d;%dH\e[7;1m%s\e[27;22m\e[K", y_ + 1, x_ + 1, "empty");
-      fflush(stdout);
+      drawText(x_, y_, "empty", TB_REVERSE | TB_BOLD, TB_DEFAULT);
       return true;
     }
 
     if(!isLoading()) {
-      fflush(stdout);
       implData_.lock();
 
       // sixel image
       if(implData_.getSixelNL()) {
-        clear();
-        printf("\e[%d;%dH", y_ + 1, x_ + 1);
-        fflush(stdout);
+        clearCells();
 
-        for(auto s: implData_.getTextRefNL()) {
-          printf("%s", s.c_str());
+        if(redrawImage || !sixelShown_) {
+          std::string data;
+          for(auto&& s: implData_.getTextRefNL()) {
+            data += s;
+          }
+
+          eraseImage();
+          tb_put_raw(x_, y_, data.c_str(), data.length());
+          sixelShown_ = true;
         }
       }
       else {
         auto size = implData_.getTextRefNL().size();
 
+        eraseImage();
         for(int i = y_; i < height_ + 1; ++i) {
-          printf("\e[%d;%dH", i + 1, x_ + 1);
-          fflush(stdout);
+          clearLine(x_, i, tb_width() - x_);
           if(size == 0 && i == y_) {
-            printf("\e[7;1m%s\e[27;22m\e[K", "empty");
+            drawText(x_, i, "empty", TB_REVERSE | TB_BOLD, TB_DEFAULT);
             continue;
           }
           if(size > static_cast<size_t>(scroll_ + i - y_)) {
-            printf("%s\e[m\e[K",
-                   strimwidth(tab2Space(implData_.getTextRefNL()[scroll_ + i - y_]), width_).c_str());
-          }
-          else {
-            printf("\e[K");
+            drawAnsiText(x_, i, tab2Space(implData_.getTextRefNL()[scroll_ + i - y_]), width_);
           }
-          fflush(stdout);
         }
       }
       implData_.unlock();
-      fflush(stdout);
       return true;
     }
     else {
@@ -1307,25 +3481,21 @@ public:
         auto msec = std::chrono::duration_cast<
           std::chrono::milliseconds>(clock - loadStartClock_).count();
 
-        if(msec >= 200) {
-          fflush(stdout);
-          clear();
-          printf("\e[%d;%dHLoading...", y_ + 1, x_ + 1);
-          fflush(stdout);
-          drawLoading_ = true;
-        }
+        if(msec >= 200) drawLoading_ = true;
+      }
+
+      if(drawLoading_) {
+        clear();
+        drawText(x_, y_, "Loading...");
       }
 
       return false;
     }
   }
 
-  void clear() const {
-    for(auto i = y_; i < height_ + 1; ++i) {
-      printf("\e[%d;%dH", i + 1, x_ + 1);
-      printf("\e[K");
-      fflush(stdout);
-    }
+  void clear() {
+    clearCells();
+    eraseImage();
   }
 
   void setPosition(int x, int y) {
@@ -1336,6 +3506,7 @@ public:
   void setSize(int width, int height) {
     width_ = width;
     height_ = height;
+    sixelShown_ = false;
 
     if(implData_.getSixel()) {
       implData_.clear();
@@ -1353,12 +3524,115 @@ public:
     return !done_;
   }
 
+  // runs img2sixel with args, the output is appended to result
+  typedef std::function<void(const std::vector<std::string>& args,
+                             std::vector<std::string>& result)> Img2Sixel;
+
+  // the sixel image fitted in scaleW x scaleH pixels
+  static std::vector<std::string> renderImage(FILE* fp, ImageUtil::IMG_TYPE header, int scaleW, int scaleH,
+                                              const FileInfo& fileInfo, std::atomic<bool>* kill,
+                                              const Img2Sixel& img2sixel) {
+    std::vector<std::string> result;
+    int w = 0, h = 0;
+
+    bool sized = getSize(fp, header, w, h);
+    int sw = w, sh = h;
+
+    if(sized && !(w < scaleW && h < scaleH)) {
+      ImageUtil::CalcScaleSize_KeepAspectRatio(w, h, scaleW, scaleH, sw, sh);
+    }
+
+    // a large JPEG from its EXIF thumbnail or scaled in the DCT
+    std::vector<unsigned char> thumbnail;
+    bool useThumbnail = sized && header == ImageUtil::IMG_JPG &&
+      getJpegThumbnail(fp, w, h, sw, sh, thumbnail);
+
+#ifdef USE_LIBSIXEL
+    SixelImage image{scaleW, scaleH, kill, ""};
+
+#ifdef USE_LIBJPEG
+    if(sized && header == ImageUtil::IMG_JPG) {
+      std::vector<unsigned char> rgb;
+      int dw, dh;
+
+      fseek(fp, 0L, SEEK_SET);
+      if(((useThumbnail && decodeJpeg(NULL, thumbnail, sw, sh, kill, rgb, dw, dh)) ||
+          decodeJpeg(fp, thumbnail, sw, sh, kill, rgb, dw, dh)) &&
+         encodeSixel(rgb, dw, dh, image)) {
+        result.emplace_back(std::move(image.data));
+        return result;
+      }
+      if(*kill) return result;
+    }
+#endif
+
+    // a huge image is left to img2sixel, which does not decode it in this process
+    if((!sized || static_cast<long>(w) * h <= MAX_DECODE_PIXELS) &&
+       encodeSixel(fileInfo.getFilePath(), image)) {
+      result.emplace_back(std::move(image.data));
+      return result;
+    }
+    if(*kill) return result;
+#endif
+
+    if(!sized || *kill) return result;
+
+    if(useThumbnail) {
+      char path[] = "/tmp/minase_thumbXXXXXX";
+      int fd = mkstemp(path);
+      if(fd != -1) {
+        bool written = write(fd, thumbnail.data(), thumbnail.size()) == static_cast<ssize_t>(thumbnail.size());
+        close(fd);
+
+        if(written) {
+          std::vector<std::string> args{"-S",
+                                        "-w" + std::to_string(sw), "-h" + std::to_string(sh),
+                                        path};
+          img2sixel(args, result);
+        }
+        unlink(path);
+
+        if(!result.empty()) return result;
+      }
+    }
+
+    std::vector<std::string> args{"-S",
+                                  "-w" + std::to_string(sw), "-h" + std::to_string(sh),
+                                  fileInfo.getFilePath()};
+    img2sixel(args, result);
+
+    return result;
+  }
+
 private:
+  void clearCells() const {
+    for(auto i = y_; i < height_ + 1; ++i) {
+      clearLine(x_, i, tb_width() - x_);
+    }
+  }
+
+  // the cells under a sixel image are sent again with the next tb_present()
+  void eraseImage() {
+    if(!sixelShown_) return;
+
+    tb_invalidate(x_, y_, tb_width() - x_, height_ + 1 - y_);
+    sixelShown_ = false;
+  }
+
   void impl(const FileInfo& fileInfo) {
     std::vector<std::string> textBuf;
     bool sixel = false;
 
-    if(fileInfo.isDir()) {
+    // 0: normal, 1: text only, 2: file info only
+    int slowFs = 0;
+    if(config.getSlowFsPreview() != 0 && fileInfo.isOnSlowFs())
+      slowFs = config.getSlowFsPreview();
+    long maxBytes = slowFs == 1 ? config.getSlowFsPreviewBytes() : 0;
+
+    if(slowFs == 2) {
+      textBuf = getPreviewStat(fileInfo);
+    }
+    else if(fileInfo.isDir()) {
       textBuf = getPreviewDir(fileInfo);
     }
     else if(fileInfo.isFifo()) {
@@ -1368,34 +3642,42 @@ private:
       textBuf.push_back("\e[7;1msock\e[27;22m");
     }
     else {
-      FILE* fp;
-      if((fp = fopen(fileInfo.getFilePath().c_str(), "rb")) == NULL) {
+      auto type = CheckFileType::classify(fileInfo.getFilePath(), maxBytes);
+      if(type == CheckFileType::Type::UNREADABLE) {
         implData_.update(fileInfo.getFileName(), textBuf, sixel);
         done_ = true;
 
         return;
       }
 
-      if(imagePreview_ && CheckFileType::isImage(fp)) {
+      FILE* fp;
+      if(slowFs == 1 && type != CheckFileType::Type::TEXT) {
+        textBuf = getPreviewStat(fileInfo);
+      }
+      else if(imagePreview_ && type == CheckFileType::Type::IMAGE &&
+         (fp = fopen(fileInfo.getFilePath().c_str(), "rb")) != NULL) {
         textBuf = getPreviewImage(fp, fileInfo);
         fclose(fp);
 
         sixel = true;
       }
       else if(CheckFileType::isAudio(fileInfo)) {
-        fclose(fp);
         textBuf = getPreviewAudioTag(fileInfo);
       }
-      else if(CheckFileType::isArchive(fp)) {
-        fclose(fp);
+      else if(type == CheckFileType::Type::ARCHIVE) {
         textBuf = getPreviewArchive(fileInfo);
       }
-      else if(!CheckFileType::isBinary(fp)) {
-        fclose(fp);
-        textBuf = getPreviewText(fileInfo);
+      else if(type == CheckFileType::Type::TEXT) {
+        textBuf = getPreviewText(fileInfo, maxBytes);
+
+        // show the matching line of the grep mode near the top
+        if(fileInfo.getMatchLine() > 0) {
+          scroll_ = std::min(fileInfo.getMatchLine() - height_ / 3,
+                             static_cast<int>(textBuf.size()) - 1);
+          if(scroll_ < 0) scroll_ = 0;
+        }
       }
       else {
-        fclose(fp);
         textBuf.push_back("\e[7;1mbinary\e[27;22m");
       }
     }
@@ -1404,6 +3686,20 @@ private:
     done_ = true;
   }
 
+  // stat only, for a slow filesystem
+  std::vector<std::string> getPreviewStat(const FileInfo& fileInfo) const {
+    std::vector<std::string> result;
+
+    result.emplace_back("\e[7;1m" + std::string(fileInfo.isDir() ? "directory" : "file") +
+                        " on a network / FUSE filesystem\e[27;22m");
+    result.emplace_back("");
+    result.emplace_back("Mode : " + FileInfo::getModeStr(fileInfo));
+    result.emplace_back("Size : " + fileInfo.getSizeText());
+    result.emplace_back("Date : " + fileInfo.getMTimeText());
+
+    return result;
+  }
+
   std::vector<std::string> getPreviewArchive(const FileInfo& fileInfo) {
     std::vector<std::string> result;
     std::vector<std::string> args{fileInfo.getFilePath()};
@@ -1451,7 +3747,9 @@ private:
   std::vector<std::string> getPreviewDir(const FileInfo& fileInfo) {
     std::vector<std::string> result;
 
-    DirInfo dir(fileInfo.getFilePath(), &kill_);
+    // cached, so that entering the directory does not read it again
+    DirInfo dir("");
+    dirCache.load(fileInfo.getFilePath(), dir, 0, &kill_);
     int maxCount;
 
     if(config.getPreViewMaxLines() != -1)
@@ -1461,10 +3759,10 @@ private:
       maxCount = dir.getCount();
 
     for(int i = 0; i < maxCount; ++i) {
-      auto f = dir.at(i);
+      const auto& f = dir.at(i);
       std::string filename;
       if(config.useIcon()) {
-        filename = getIcon(f) + " " + f.getFileName();
+        filename = std::string(getIcon(f)) + " " + f.getFileName();
       }
       else {
         filename = f.getFileName();
@@ -1503,7 +3801,6 @@ private:
     int col, row, xpixel, ypixel;
     getTermSize(&col, &row, &xpixel, &ypixel);
 
-    int w = 0, h = 0;
     auto header = ImageUtil::checkHeader(fp);
     if(header == ImageUtil::IMG_TGA) {
       auto suffix = fileInfo.getSuffix();
@@ -1515,28 +3812,271 @@ private:
       }
     }
 
-    if(!getSize(fp, header, w, h)) {
-      return result;
-    }
-
     int cw = xpixel / col, ch = ypixel / row;
     int scaleW = xpixel - (x_ * cw) - (cw * 2);
     int scaleH = ypixel - (y_ * ch) - (ch * 3);
-    int sw = w, sh = h;
 
-    if(!(w < scaleW && h < scaleH)) {
-      ImageUtil::CalcScaleSize_KeepAspectRatio(w, h, scaleW, scaleH, sw, sh);
+    std::string data;
+    if(sixelCache.load(fp, scaleW, scaleH, data)) {
+      result.emplace_back(std::move(data));
+      return result;
     }
 
-    if(kill_) return result;
-    std::vector<std::string> args{"-S",
-                                  "-w" + std::to_string(sw), "-h" + std::to_string(sh),
-                                  fileInfo.getFilePath()};
-    getProcessText("img2sixel", args, result);
+    result = renderImage(fp, header, scaleW, scaleH, fileInfo, &kill_,
+                         [this](const std::vector<std::string>& args, std::vector<std::string>& text) {
+                           getProcessText("img2sixel", args, text);
+                         });
+    if(!kill_ && !result.empty() && result[0].compare(0, 2, "\eP") == 0) {
+      for(const auto& s: result) data += s;
+      sixelCache.store(fp, scaleW, scaleH, data);
+    }
+
+    return result;
+  }
+
+  // the EXIF thumbnail of a w x h JPEG, if it is at least sw x sh and has
+  // the same aspect ratio
+  static bool getJpegThumbnail(FILE* fp, int w, int h, int sw, int sh,
+                               std::vector<unsigned char>& thumbnail) {
+    int tw, th;
+    bool result = ImageUtil::getExifThumbnail(fp, thumbnail) &&
+      ImageUtil::getJpegSize(thumbnail.data(), thumbnail.size(), tw, th) &&
+      tw >= sw && th >= sh &&
+      std::abs(static_cast<double>(tw) / th - static_cast<double>(w) / h) < 0.02 * w / h;
+
+    fseek(fp, 0L, SEEK_SET);
+    if(!result) thumbnail.clear();
 
     return result;
   }
 
+#ifdef USE_LIBSIXEL
+  static const long MAX_DECODE_PIXELS = 24L * 1024 * 1024;
+
+  struct SixelImage {
+    int maxW, maxH;
+    std::atomic<bool>* kill;
+    std::string data;
+  };
+
+  // decodes the image in-process, the sixel sequence is written to
+  // image.data
+  static bool encodeSixel(const std::string& path, SixelImage& image) {
+    auto status = sixel_helper_load_image_file(path.c_str(), 1, 0, SIXEL_PALETTE_MAX, NULL,
+                                               SIXEL_LOOP_DISABLE, encodeSixelFrame, 0, NULL,
+                                               &image, NULL);
+
+    return SIXEL_SUCCEEDED(status) && !*image.kill && !image.data.empty();
+  }
+
+  static SIXELSTATUS encodeSixelFrame(sixel_frame_t* frame, void* context) {
+    auto image = static_cast<SixelImage*>(context);
+    if(*image -> kill) return SIXEL_INTERRUPTED;
+
+    int w = sixel_frame_get_width(frame), h = sixel_frame_get_height(frame);
+    if(w <= 0 || h <= 0 || static_cast<long>(w) * h > MAX_DECODE_PIXELS) return SIXEL_BAD_INPUT;
+
+    // to RGB888, PAL8 or G8 (w * h bytes at the head of rgb)
+    std::vector<unsigned char> rgb(static_cast<size_t>(w) * h * 3);
+    int format;
+    auto status = sixel_helper_normalize_pixelformat(rgb.data(), &format,
+                                                     sixel_frame_get_pixels(frame),
+                                                     sixel_frame_get_pixelformat(frame), w, h);
+    if(SIXEL_FAILED(status)) return status;
+
+    // PAL8 and G8 are expanded in place from the end, pixel i is read
+    // before rgb[i * 3] is written
+    size_t n = static_cast<size_t>(w) * h;
+    if(format == SIXEL_PIXELFORMAT_PAL8) {
+      auto palette = sixel_frame_get_palette(frame);
+      int ncolors = sixel_frame_get_ncolors(frame);
+      if(palette == NULL) return SIXEL_BAD_INPUT;
+
+      for(size_t i = n; i-- > 0;) {
+        int c = rgb[i] < ncolors ? rgb[i] : 0;
+        std::copy(palette + c * 3, palette + c * 3 + 3, rgb.begin() + i * 3);
+      }
+    }
+    else if(format == SIXEL_PIXELFORMAT_G8) {
+      for(size_t i = n; i-- > 0;) {
+        auto g = rgb[i];
+        rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = g;
+      }
+    }
+    else if(format != SIXEL_PIXELFORMAT_RGB888) return SIXEL_BAD_INPUT;
+
+    return encodeSixel(rgb, w, h, *image) ? SIXEL_OK : SIXEL_INTERRUPTED;
+  }
+
+  // downscales RGB888 pixels to the size of the pane and encodes them
+  static bool encodeSixel(std::vector<unsigned char>& rgb, int w, int h, SixelImage& image) {
+    int sw = w, sh = h;
+    if(!(w < image.maxW && h < image.maxH)) {
+      ImageUtil::CalcScaleSize_KeepAspectRatio(w, h, image.maxW, image.maxH, sw, sh);
+      if(sw <= 0 || sh <= 0) return false;
+
+      std::vector<unsigned char> scaled(static_cast<size_t>(sw) * sh * 3);
+      ImageUtil::Resize_AreaAverage(rgb.data(), w, h, scaled.data(), sw, sh);
+      rgb.swap(scaled);
+    }
+    if(*image.kill) return false;
+
+    sixel_output_t* output = NULL;
+    sixel_dither_t* dither = NULL;
+
+    auto status = sixel_output_new(&output, writeSixel, &image.data, NULL);
+    if(SIXEL_SUCCEEDED(status)) status = sixel_dither_new(&dither, SIXEL_PALETTE_MAX, NULL);
+    if(SIXEL_SUCCEEDED(status)) {
+      status = sixel_dither_initialize(dither, rgb.data(), sw, sh, SIXEL_PIXELFORMAT_RGB888,
+                                       SIXEL_LARGE_AUTO, SIXEL_REP_AUTO, SIXEL_QUALITY_AUTO);
+    }
+    if(SIXEL_SUCCEEDED(status)) status = sixel_encode(rgb.data(), sw, sh, 3, dither, output);
+
+    if(dither != NULL) sixel_dither_unref(dither);
+    if(output != NULL) sixel_output_unref(output);
+
+    return SIXEL_SUCCEEDED(status) && !image.data.empty();
+  }
+
+  static int writeSixel(char* data, int size, void* priv) {
+    static_cast<std::string*>(priv) -> append(data, size);
+    return size;
+  }
+#endif
+
+#ifdef USE_LIBJPEG
+  struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jmp;
+  };
+
+  static void jpegErrorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<JpegError*>(cinfo -> err) -> jmp, 1);
+  }
+
+  // a warning such as "Premature end of JPEG file" would be written over
+  // the screen
+  static void jpegOutputMessage(j_common_ptr) {}
+
+  // decodes a JPEG from fp, or from data if fp is NULL, to RGB888. it is
+  // scaled in the DCT by 1/2, 1/4 or 1/8 if it stays at least minW x minH.
+  static bool decodeJpeg(FILE* fp, const std::vector<unsigned char>& data, int minW, int minH,
+                         std::atomic<bool>* kill, std::vector<unsigned char>& rgb, int& w, int& h) {
+    jpeg_decompress_struct cinfo;
+    JpegError error;
+
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpegErrorExit;
+    error.mgr.output_message = jpegOutputMessage;
+    if(setjmp(error.jmp)) {
+      jpeg_destroy_decompress(&cinfo);
+      return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    if(fp != NULL) jpeg_stdio_src(&cinfo, fp);
+    else jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data.data()), data.size());
+    jpeg_read_header(&cinfo, TRUE);
+
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+    for(unsigned int d = 8; d > 1; d /= 2) {
+      if(static_cast<int>((cinfo.image_width + d - 1) / d) >= minW &&
+         static_cast<int>((cinfo.image_height + d - 1) / d) >= minH) {
+        cinfo.scale_denom = d;
+        break;
+      }
+    }
+    jpeg_start_decompress(&cinfo);
+
+    w = cinfo.output_width, h = cinfo.output_height;
+    rgb.resize(static_cast<size_t>(w) * h * 3);
+    while(cinfo.output_scanline < cinfo.output_height) {
+      JSAMPROW row = rgb.data() + static_cast<size_t>(cinfo.output_scanline) * w * 3;
+      jpeg_read_scanlines(&cinfo, &row, 1);
+
+      if(*kill) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+      }
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return true;
+  }
+#endif
+
+  // the rest of a UTF-16 file after the BOM, converted to the locale
+  // charset. CRLF is removed. read and converted in chunks until maxLines
+  // lines or maxBytes bytes.
+  std::string readUtf16(FILE* fp, const std::string& charset, int maxLines, long maxBytes) {
+    std::string toCharset = std::string(nl_langinfo(CODESET)) + "//IGNORE";
+    auto iv = iconv_open(toCharset.c_str(), charset.c_str());
+    if(iv == reinterpret_cast<iconv_t>(-1)) return "";
+
+    std::vector<char> src(65536), dst(src.size() * 2);
+    std::string txt, out;
+    size_t rest = 0;
+    long total = 0;
+    int cnt = 0;
+    bool end = false;
+
+    while(!end && (maxLines == -1 || cnt <= maxLines)) {
+      if(kill_) {
+        iconv_close(iv);
+        return "";
+      }
+
+      size_t len = fread(src.data() + rest, 1, src.size() - rest, fp);
+      total += len;
+      end = len == 0 || (maxBytes > 0 && total >= maxBytes);
+
+      char* psrc = src.data();
+      size_t srclen = rest + len;
+      if(end) srclen &= ~static_cast<size_t>(1);
+
+      // the bytes of an incomplete character are kept for the next chunk
+      while(srclen > 0) {
+        char* pdst = dst.data();
+        size_t dstlen = dst.size();
+        auto r = iconv(iv, &psrc, &srclen, &pdst, &dstlen);
+        int err = errno;
+        out.append(dst.data(), pdst - dst.data());
+
+        if(r != static_cast<size_t>(-1) || err == EINVAL) break;
+        if(err == EILSEQ && srclen >= 2) {
+          psrc += 2;
+          srclen -= 2;
+        }
+        else if(err != E2BIG) break;
+      }
+      rest = end ? 0 : srclen;
+      memmove(src.data(), psrc, rest);
+
+      size_t i = 0, j;
+      while((j = out.find('\n', i)) != std::string::npos) {
+        if(j > i && out[j - 1] == '\r') txt.append(out, i, j - 1 - i);
+        else txt.append(out, i, j - i);
+        txt += '\n';
+        i = j + 1;
+
+        if(maxLines != -1 && ++cnt > maxLines) break;
+      }
+      out.erase(0, i);
+    }
+    iconv_close(iv);
+
+    if(end && !out.empty() && (maxLines == -1 || cnt <= maxLines)) {
+      if(out.back() == '\r') out.pop_back();
+      txt += out + '\n';
+    }
+
+    return txt;
+  }
+
   std::string detectCharset(const std::string& txt) const {
     uchardet_t ucd = uchardet_new();
 
@@ -1558,7 +4098,8 @@ private:
     }
   }
 
-  std::vector<std::string> getPreviewText(const FileInfo& fileInfo) {
+  // maxBytes: stop reading after about maxBytes, 0: no limit
+  std::vector<std::string> getPreviewText(const FileInfo& fileInfo, long maxBytes = 0) {
     std::vector<std::string> ret;
 
     FILE* fp;
@@ -1569,8 +4110,20 @@ private:
     int cnt = 0;
     char rbuf[512];
 
-    std::string txt;
-    while(!feof(fp)) {
+    // read far enough to show the matching line of the grep mode
+    int maxLines = config.getPreViewMaxLines();
+    if(maxLines != -1 && fileInfo.getMatchLine() > 0)
+      maxLines = std::max(maxLines, fileInfo.getMatchLine() + height_);
+
+    std::string txt, charset;
+    unsigned char bom[2] = {0};
+    if(fread(bom, 1, sizeof(bom), fp) == sizeof(bom) && CheckFileType::isUtf16(bom)) {
+      charset = bom[0] == 0xFF ? "UTF-16LE" : "UTF-16BE";
+      txt = readUtf16(fp, charset, maxLines, maxBytes);
+    }
+    else fseek(fp, 0L, SEEK_SET);
+
+    while(charset.empty() && !feof(fp)) {
       if(fgets(rbuf, sizeof(rbuf), fp) != 0) {
         txt += rbuf;
 
@@ -1587,8 +4140,9 @@ private:
         txt.push_back('\n');
       }
 
-      if(config.getPreViewMaxLines() == -1) ++cnt;
-      else if(++cnt > config.getPreViewMaxLines()) break;
+      if(maxLines == -1) ++cnt;
+      else if(++cnt > maxLines) break;
+      if(maxBytes > 0 && static_cast<long>(txt.size()) >= maxBytes) break;
 
       if(kill_) {
         fclose(fp);
@@ -1597,9 +4151,14 @@ private:
     }
     fclose(fp);
 
-    auto charset = detectCharset(txt);
-    if(!charset.empty()) {
-      if(!(charset == "ASCII" || charset == nl_langinfo(CODESET))) {
+    // uchardet only for a text that is not UTF-8
+    if(charset.empty()) {
+      auto sniff = CheckFileType::sniff(reinterpret_cast<const unsigned char*>(txt.data()), txt.size());
+      if(sniff.ascii) charset = "ASCII";
+      else if(sniff.utf8) charset = "UTF-8";
+      else charset = detectCharset(txt);
+
+      if(!charset.empty() && !(charset == "ASCII" || charset == nl_langinfo(CODESET))) {
         size_t srclen = txt.length() + 1;
         size_t dstlen = txt.length() * 3 + 1;
 
@@ -1634,67 +4193,48 @@ private:
       ret.push_back(buf);
     }
 
+    // line 0 is the header
+    auto line = fileInfo.getMatchLine();
+    if(line > 0 && line < static_cast<int>(ret.size())) ret[line] = "\e[7m" + ret[line];
+
     return ret;
   }
 
   bool getProcessText(const std::string& cmd,
                       const std::vector<std::string>& args,
                       std::vector<std::string>& buf, int maxline = 0) {
-    int pipefd = 1;
+    std::vector<std::string> argv{cmd};
+    argv.insert(argv.end(), args.begin(), args.end());
 
-    int pid = popen2(cmd, args, 0, &pipefd);
-    if(pid < 0) {
+    Process process;
+    if(!process.start(argv, Process::PIPE)) {
       perror("can not exec command");
       return false;
     }
-    pid_ = pid;
-
-    FILE* fp;
-    if((fp = fdopen(pipefd, "r")) == NULL) {
-      perror("fdopen");
-
-      close(pipefd);
-      pclose2(pid_);
-      pid_ = 0;
-
-      return false;
-    }
+    pid_ = process.getPid();
 
-    char rbuf[4096];
+    std::string text;
     int cnt = 0;
-    while(!feof(fp)) {
-
-      if(fgets(rbuf, sizeof(rbuf), fp) != 0)
-        buf.emplace_back(rbuf);
-
-      if(kill_) break;
-      if(maxline != 0 && ++cnt > maxline) break;
+    bool more = true;
+    while(more && !kill_ && (maxline == 0 || cnt <= maxline)) {
+      more = process.read(text, 100);
+
+      size_t start = 0, end;
+      while((end = text.find('\n', start)) != std::string::npos) {
+        buf.emplace_back(text, start, end + 1 - start);
+        start = end + 1;
+        ++cnt;
+      }
+      text.erase(0, start);
     }
+    if(!more && !text.empty()) buf.emplace_back(std::move(text));
 
-    fclose(fp);
-    close(pipefd);
-    pclose2(pid_);
+    process.wait();
     pid_ = 0;
 
     return true;
   }
 
-  void getTermSize(int* col, int* row, int* xpixel, int* ypixel) const {
-    struct winsize ws;
-
-    // get terminal size
-    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != -1) {
-      *col = ws.ws_col; // width
-      *row = ws.ws_row; // height
-      *xpixel = ws.ws_xpixel;
-      *ypixel = ws.ws_ypixel;
-
-      return;
-    }
-
-    *col = *row = *xpixel = *ypixel = -1;
-  }
-
   class PreViewData {
   public:
     PreViewData() {}
@@ -1762,7 +4302,7 @@ private:
 
   std::thread thread_;
 
-  bool disable_, drawLoading_, imagePreview_;
+  bool disable_, drawLoading_, imagePreview_, sixelShown_;
   int x_, y_, width_, height_, scroll_;
   std::chrono::system_clock::time_point loadStartClock_;
 
@@ -1771,15 +4311,187 @@ private:
   NanoSyntaxHighlight highlight_;
 };
 
+/*
+ * Makes the thumbnails of the gallery view on a pool of worker threads.
+ * The files are taken in the order of the last request, so the visible
+ * ones come first. The thumbnails are kept in memory and in sixelCache.
+ */
+class ThumbnailLoader {
+public:
+  ThumbnailLoader() : kill_(false), update_(false), width_(0), height_(0) {}
+
+  ~ThumbnailLoader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      kill_ = true;
+      queue_.clear();
+    }
+    cv_.notify_all();
+
+    for(auto&& t: workers_) {
+      if(t.joinable()) t.join();
+    }
+  }
+
+  // make the thumbnails of files fitted in width x height pixels. the files
+  // of the previous request that are not started yet are dropped.
+  void request(const std::vector<FileInfo>& files, int width, int height) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(width != width_ || height != height_) {
+      thumbnails_.clear();
+      width_ = width;
+      height_ = height;
+    }
+    if(thumbnails_.size() > MAX_THUMBNAILS) thumbnails_.clear();
+
+    queue_.clear();
+    for(const auto& fileInfo: files) {
+      auto it = thumbnails_.find(fileInfo.getFilePath());
+      if(it != thumbnails_.end() && isValid(it -> second, fileInfo)) continue;
+
+      queue_.emplace_back(fileInfo);
+    }
+
+    if(queue_.empty()) return;
+
+    if(workers_.empty()) {
+      int n = std::thread::hardware_concurrency();
+      n = std::max(1, std::min(n, 4));
+
+      for(int i = 0; i < n; ++i)
+        workers_.emplace_back(&ThumbnailLoader::worker, this);
+    }
+    cv_.notify_all();
+  }
+
+  // true if the thumbnail of fileInfo is made. data is empty if the file
+  // has none.
+  bool get(const FileInfo& fileInfo, std::string& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = thumbnails_.find(fileInfo.getFilePath());
+    if(it == thumbnails_.end() || !isValid(it -> second, fileInfo)) return false;
+
+    data = it -> second.data;
+    return true;
+  }
+
+  bool isUpdate() {
+    return update_.exchange(false);
+  }
+
+private:
+  static const size_t MAX_THUMBNAILS = 1024;
+
+  struct Thumbnail {
+    timespec mtime;
+    off_t size;
+    std::string data;
+  };
+
+  static bool isValid(const Thumbnail& thumbnail, const FileInfo& fileInfo) {
+    return thumbnail.size == fileInfo.getSize() &&
+      thumbnail.mtime.tv_sec == fileInfo.getMTime().tv_sec &&
+      thumbnail.mtime.tv_nsec == fileInfo.getMTime().tv_nsec;
+  }
+
+  void worker() {
+    while(1) {
+      std::unique_ptr<FileInfo> fileInfo;
+      int width, height;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return kill_ || !queue_.empty(); });
+        if(kill_) return;
+
+        fileInfo.reset(new FileInfo(queue_.front()));
+        queue_.pop_front();
+        width = width_;
+        height = height_;
+      }
+
+      auto data = make(*fileInfo, width, height);
+      if(kill_) return;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(width != width_ || height != height_) continue;
+
+        thumbnails_[fileInfo -> getFilePath()] =
+          Thumbnail{fileInfo -> getMTime(), fileInfo -> getSize(), std::move(data)};
+      }
+      update_ = true;
+    }
+  }
+
+  std::string make(const FileInfo& fileInfo, int width, int height) {
+    std::string data;
+
+    if(config.getSlowFsPreview() != 0 && fileInfo.isOnSlowFs()) return data;
+    if(CheckFileType::classify(fileInfo.getFilePath()) != CheckFileType::Type::IMAGE) return data;
+
+    FILE* fp = fopen(fileInfo.getFilePath().c_str(), "rb");
+    if(fp == NULL) return data;
+
+    auto header = ImageUtil::checkHeader(fp);
+    if(header == ImageUtil::IMG_TGA) {
+      auto suffix = fileInfo.getSuffix();
+      std::transform(suffix.begin(), suffix.end(), suffix.begin(), tolower);
+
+      if(suffix != "tga") {
+        fclose(fp);
+        return data;
+      }
+    }
+
+    if(!sixelCache.load(fp, width, height, data)) {
+      auto result = PreView::renderImage(fp, header, width, height, fileInfo, &kill_, img2sixel);
+      for(const auto& s: result) data += s;
+
+      if(!kill_ && data.compare(0, 2, "\eP") == 0) sixelCache.store(fp, width, height, data);
+      else data.clear();
+    }
+    fclose(fp);
+
+    return data;
+  }
+
+  static void img2sixel(const std::vector<std::string>& args, std::vector<std::string>& result) {
+    std::vector<std::string> argv{"img2sixel"};
+    argv.insert(argv.end(), args.begin(), args.end());
+
+    Process process;
+    if(!process.start(argv, Process::PIPE)) return;
+
+    std::string buf;
+    while(process.read(buf));
+    process.wait();
+
+    if(!buf.empty()) result.emplace_back(std::move(buf));
+  }
+
+  std::atomic<bool> kill_, update_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+  std::deque<FileInfo> queue_;
+  tsl::robin_map<std::string, Thumbnail> thumbnails_;
+  int width_, height_;
+};
+ThumbnailLoader thumbnailLoader;
+
 class FileView {
 public:
   FileView(const std::string& path) :
     dir_(path), path_(path), lastPath_(path), x_(0), y_(0),
     width_(20), height_(25), cursorPos_(0), oldScrollTop_(0),
-    scroll_(false), viewType_(ViewType::SIMPLE) {
+    drawnScrollTop_(-1), drawnCursor_(0), drawnCount_(0), scroll_(false), dirSizeMode_(false), searchMode_(false), grepMode_(false),
+    truncated_(false), viewType_(ViewType::SIMPLE) {
 
     if(config.getFileViewType() == 0) viewType_ = ViewType::SIMPLE;
     if(config.getFileViewType() == 1) viewType_ = ViewType::DETAIL;
+    if(config.getFileViewType() == 2) viewType_ = ViewType::GALLERY;
   }
 
   std::string getPath() const { return path_; }
@@ -1788,10 +4500,21 @@ public:
     if(dir == NULL) return false;
     closedir(dir);
 
+    if(!searchMode_ && !isFileListEmpty()) dirCache.setCursor(path_, getCurrentFileName());
+
+    stopSearch();
     lastPath_ = path_;
     path_ = path;
-    update();
-    setCursorPos(0);
+
+    std::string cursor;
+    load(&cursor);
+
+    int pos = cursor.empty() ? -1 : searchFileName(cursor);
+    setCursorPos(pos != -1 ? pos : 0);
+
+    // so that upDir() does not have to wait
+    auto i = path_.find_last_of('/', path_.length() - 2);
+    if(path_ != "/" && i != std::string::npos) dirCache.prefetch(path_.substr(0, i + 1));
 
     return true;
   }
@@ -1799,6 +4522,7 @@ public:
   enum ViewType {
     SIMPLE,
     DETAIL,
+    GALLERY,
   };
 
   ViewType getViewType() const {
@@ -1837,11 +4561,8 @@ public:
     return dir_.isShowHiddenFiles();
   }
 
-  int searchFileName(const std::string& fileName) {
-    for(int i = 0; i < dir_.getCount(); ++i)
-      if(dir_.at(i).getFileName() == fileName) return i;
-
-    return -1;
+  int searchFileName(const std::string& fileName, int matchLine = 0) {
+    return dir_.find(fileName, matchLine);
   }
 
   std::string getLastPath() const { return lastPath_; }
@@ -1849,8 +4570,8 @@ public:
   bool isFileListEmpty() const { return dir_.getCount() == 0; }
   std::string getCurrentFileName() const { return dir_.at(cursorPos_).getFileName(); }
   std::string getCurrentFilePath() const { return dir_.at(cursorPos_).getFilePath(); }
-  FileInfo getCurrentFileInfo() const { return dir_.at(cursorPos_); }
-  FileInfo getFileInfo(int i) const { return dir_.at(i); }
+  const FileInfo& getCurrentFileInfo() const { return dir_.at(cursorPos_); }
+  const FileInfo& getFileInfo(int i) const { return dir_.at(i); }
   int getCursorPos() const { return cursorPos_; }
   void setCursorPos(int pos) {
     cursorPos_ = pos;
@@ -1881,7 +4602,135 @@ public:
   }
 
   bool update() {
-    return dir_.chdir(path_);
+    if(searchMode_) {
+      dir_.refreshFiles();
+      return true;
+    }
+
+    return load();
+  }
+
+  // list the files under the current directory that match filter
+  void startSearch(const std::string& filter, DirInfo::FilterType type) {
+    stopSearch();
+
+    searchMode_ = true;
+    searchQuery_ = filter;
+    dir_.setFiles(path_, std::vector<std::string>());
+    search_.reset(new FileSearch(path_, filter, type, isShowHiddenFiles()));
+    lastSearchUpdate_ = std::chrono::steady_clock::now();
+    setCursorPos(0);
+  }
+
+  // list the lines of the files under the current directory that match
+  // pattern (extended regexp)
+  bool startGrep(const std::string& pattern) {
+    std::unique_ptr<ContentSearch> grep(new ContentSearch(path_, pattern, isShowHiddenFiles()));
+    if(!grep -> isValid()) return false;
+
+    stopSearch();
+
+    searchMode_ = grepMode_ = true;
+    searchQuery_ = pattern;
+    dir_.setFiles(path_, std::vector<std::string>());
+    grep_ = std::move(grep);
+    lastSearchUpdate_ = std::chrono::steady_clock::now();
+    setCursorPos(0);
+
+    return true;
+  }
+
+  void stopSearch() {
+    search_.reset();
+    grep_.reset();
+    searchMode_ = grepMode_ = truncated_ = false;
+    searchQuery_.clear();
+  }
+
+  bool isSearchMode() const { return searchMode_; }
+  bool isSearching() const { return search_ != nullptr || grep_ != nullptr; }
+  std::string getSearchLabel() const {
+    return std::string(grepMode_ ? "grep: " : "find: ") + searchQuery_ +
+      (truncated_ ? " (truncated)" : "");
+  }
+
+  // add the files found so far, at most every 100ms
+  bool updateSearch() {
+    if(!isSearching()) return false;
+
+    auto done = search_ ? search_ -> isDone() : grep_ -> isDone();
+    auto now = std::chrono::steady_clock::now();
+    if(!done && now - lastSearchUpdate_ < std::chrono::milliseconds(100)) return false;
+    lastSearchUpdate_ = now;
+
+    std::string currentFileName;
+    int currentLine = 0;
+    if(!isFileListEmpty()) {
+      currentFileName = getCurrentFileName();
+      currentLine = getCurrentFileInfo().getMatchLine();
+    }
+
+    bool update = false;
+    if(search_) {
+      std::vector<std::string> results;
+      if(search_ -> getResults(results)) {
+        dir_.addFiles(results);
+        update = true;
+      }
+    }
+    else {
+      std::vector<ContentSearch::Match> matches;
+      if(grep_ -> getResults(matches)) {
+        std::vector<FileInfo> files;
+        for(const auto& m: matches) {
+          files.emplace_back(path_, m.name);
+          files.back().setMatch(m.line, m.text);
+        }
+
+        dir_.addFiles(files);
+        update = true;
+      }
+    }
+
+    if(update) {
+      int pos = currentFileName.empty() ? -1 : searchFileName(currentFileName, currentLine);
+      cursorPos_ = pos != -1 ? pos : 0;
+    }
+
+    if(done) {
+      truncated_ = grep_ && grep_ -> isTruncated();
+      search_.reset();
+      grep_.reset();
+    }
+    return true;
+  }
+
+  bool isDirSizeMode() const { return dirSizeMode_; }
+  void setDirSizeMode(bool v) {
+    dirSizeMode_ = v;
+
+    if(v) dirSizeCalculator.request(dir_.getDirPaths());
+    updateDirSizes();
+  }
+
+  // recalculate the directory sizes without the cache
+  void recalcDirSizes() {
+    if(dirSizeMode_) dirSizeCalculator.request(dir_.getDirPaths(), false);
+  }
+
+  bool updateDirSizes() {
+    if(isFileListEmpty()) return dir_.updateDirSizes(dirSizeMode_);
+
+    auto currentFileName = getCurrentFileName();
+    if(!dir_.updateDirSizes(dirSizeMode_)) return false;
+
+    if(dir_.getSortType() == DirInfo::SortType::SIZE) {
+      int pos = searchFileName(currentFileName);
+      if(pos != -1) setCursorPos(pos);
+      else setCursorPos(0);
+    }
+
+    return true;
   }
 
   bool isSelectedFile(const FileInfo& fileInfo) const {
@@ -1915,7 +4764,7 @@ public:
   bool cursorPgDn() {
     if(getFileListCount() == 0) return false;
 
-    int scroll = height_ / 2;
+    int scroll = getScrollStep();
     if(cursorPos_ + scroll < getFileListCount() - 1) {
       cursorPos_ = cursorPos_ + scroll;
       scroll_ = true;
@@ -1931,7 +4780,7 @@ public:
   }
 
   bool cursorPgUp() {
-    int scroll = height_ / 2;
+    int scroll = getScrollStep();
     if(cursorPos_ - scroll > 0) {
       cursorPos_ = cursorPos_ - scroll;
       scroll_ = true;
@@ -1956,6 +4805,14 @@ public:
   void cursorMoveMiddleOfScreen() {
     if(dir_.getCount() == 0) return;
 
+    // the first tile of the middle row
+    if(viewType_ == ViewType::GALLERY) {
+      int cols = getGalleryCols();
+      int rows = std::min(getGalleryRows(), (dir_.getCount() - oldScrollTop_ + cols - 1) / cols);
+      cursorPos_ = std::min(oldScrollTop_ + (rows - 1) / 2 * cols, dir_.getCount() - 1);
+      return;
+    }
+
     cursorPos_ = oldScrollTop_ + (height_ / 2) - 1;
     if(oldScrollTop_ + height_ > dir_.getCount())
       cursorPos_ = dir_.getCount() / 2 - 1;
@@ -1968,6 +4825,11 @@ public:
   void cursorMoveBottomOfScreen() {
     if(dir_.getCount() == 0) return;
 
+    if(viewType_ == ViewType::GALLERY) {
+      cursorPos_ = std::min(oldScrollTop_ + getGalleryCols() * getGalleryRows(), dir_.getCount()) - 1;
+      return;
+    }
+
     cursorPos_ = oldScrollTop_ + height_ - 1;
     if(oldScrollTop_ + height_ > dir_.getCount())
       cursorPos_ = dir_.getCount() - 1;
@@ -1995,7 +4857,30 @@ public:
     return false;
   }
 
+  // one row down/up in the grid of the gallery view
+  bool cursorNextRow() {
+    int cols = getGalleryCols();
+    if(cursorPos_ / cols < (getFileListCount() - 1) / cols) {
+      cursorPos_ = std::min(cursorPos_ + cols, getFileListCount() - 1);
+      return true;
+    }
+
+    return false;
+  }
+
+  bool cursorPrevRow() {
+    int cols = getGalleryCols();
+    if(cursorPos_ >= cols) {
+      cursorPos_ -= cols;
+      return true;
+    }
+
+    return false;
+  }
+
   bool upDir() {
+    if(searchMode_) return setPath(path_);
+
     auto oldPath = path_;
     auto i = path_.find_last_of('/', path_.length() - 2);
     if(i != std::string::npos) {
@@ -2021,7 +4906,8 @@ public:
       int oldPos = searchFileName(fileName);
       int h = oldPos - oldScrollTop_;
 
-      setPath(getPath());
+      if(searchMode_) update();
+      else setPath(getPath());
 
       int pos = searchFileName(fileName);
       if(pos == -1 || oldPos == -1) {
@@ -2038,12 +4924,123 @@ public:
       }
     }
     else {
-      setPath(getPath());
+      if(searchMode_) update();
+      else setPath(getPath());
       setCursorPos(0);
     }
   }
 
   void draw() {
+    if(viewType_ == ViewType::GALLERY) {
+      drawGallery(true);
+      return;
+    }
+
+    eraseThumbnails();
+    drawRows(updateScrollTop());
+  }
+
+  // redraw only the rows of the old and the new cursor position, or the
+  // whole view if it has scrolled
+  void drawCursorMove() {
+    if(viewType_ == ViewType::GALLERY) {
+      drawGallery(false);
+      return;
+    }
+
+    auto scrollTop = updateScrollTop();
+
+    if(scrollTop != drawnScrollTop_ || dir_.getCount() != drawnCount_) {
+      for(int i = 0; i < height_; ++i)
+        clearLine(x_, y_ + i, width_ + 1);
+
+      drawRows(scrollTop);
+      return;
+    }
+
+    for(auto pos: {drawnCursor_, cursorPos_}) {
+      if(pos < scrollTop || pos >= scrollTop + height_ || pos >= dir_.getCount()) continue;
+
+      clearLine(x_, y_ + pos - scrollTop, width_ + 1);
+      drawRow(pos - scrollTop, scrollTop);
+    }
+    drawnCursor_ = cursorPos_;
+  }
+
+  // sends the thumbnails that have been made since the gallery view was
+  // drawn. returns true if any is drawn.
+  bool drawThumbnails() {
+    if(viewType_ != ViewType::GALLERY) return false;
+
+    int cols = getGalleryCols();
+    bool update = false;
+
+    for(size_t slot = 0; slot < thumbnailShown_.size(); ++slot) {
+      int i = drawnScrollTop_ + slot;
+      if(i >= dir_.getCount()) break;
+      if(thumbnailShown_[slot]) continue;
+
+      std::string data;
+      if(!thumbnailLoader.get(dir_.at(i), data)) continue;
+      thumbnailShown_[slot] = true;
+      update = true;
+
+      int x = x_ + (slot % cols) * GALLERY_TILE_W + 1;
+      int y = y_ + (slot / cols) * GALLERY_TILE_H;
+      drawText(x, y, "   ");
+      if(!data.empty()) tb_put_raw(x, y, data.c_str(), data.length());
+    }
+
+    return update;
+  }
+
+  // draws the file name trimmed to w columns. a long name keeps its
+  // suffix ("longna~.txt"). returns the drawn width.
+  int drawFileName(int x, int y, const FileInfo& fileInfo, int w, uint16_t fg, uint16_t bg) const {
+    int cnt = 0;
+    if(w <= 0) return 0;
+
+    if(config.useIcon() && fileInfo.getMatchLine() == 0) {
+      auto icon = getIcon(fileInfo);
+      cnt = drawUtf8(x, y, icon, strlen(icon), fg, bg, w);
+      cnt += drawUtf8(x + cnt, y, " ", 1, fg, bg, w - cnt);
+    }
+
+    const auto& name = fileInfo.getDisplayName();
+    int rest = w - cnt;
+
+    if(name.width() <= rest)
+      return cnt + name.draw(x + cnt, y, 0, name.size(), fg, bg);
+
+    auto suffixPos = fileInfo.getSuffixPos();
+    if(suffixPos >= 0) {
+      // "~" + ".suffix"
+      int suffixWidth = 1 + name.width() - name.width(suffixPos);
+
+      if(suffixWidth <= rest) {
+        cnt += name.draw(x + cnt, y, 0, name.fit(rest - suffixWidth), fg, bg);
+        cnt += drawUtf8(x + cnt, y, "~", 1, fg, bg);
+        return cnt + name.draw(x + cnt, y, suffixPos, name.size(), fg, bg);
+      }
+    }
+
+    return cnt + name.draw(x + cnt, y, 0, name.fit(rest), fg, bg);
+  }
+
+private:
+  // the current directory, from dirCache if it has not changed
+  bool load(std::string* cursor = 0) {
+    auto result = dirCache.load(path_, dir_, cursor);
+
+    if(dirSizeMode_) {
+      dirSizeCalculator.request(dir_.getDirPaths());
+      dir_.updateDirSizes(true);
+    }
+
+    return result;
+  }
+
+  int updateScrollTop() {
     int scrollTop = 0;
 
     if(cursorPos_ > height_ / 2) {
@@ -2055,144 +5052,546 @@ public:
         if(scrollTop < 0) scrollTop = 0;
       }
     }
-    else scrollTop = 0;
+    else scrollTop = 0;
+
+    if(!scroll_) {
+      if(oldScrollTop_ + height_ - y_ < cursorPos_) ++oldScrollTop_;
+      else if(oldScrollTop_ > cursorPos_) --oldScrollTop_;
+
+      if(height_ > dir_.getCount() - 1) {
+        oldScrollTop_ = 0;
+      }
+      scrollTop = oldScrollTop_;
+    }
+    oldScrollTop_ = scrollTop;
+
+    return scrollTop;
+  }
+
+  void drawRows(int scrollTop) {
+    drawnScrollTop_ = scrollTop;
+    drawnCursor_ = cursorPos_;
+    drawnCount_ = dir_.getCount();
+
+    for(auto i = 0; i < height_; ++i) {
+      if(dir_.getCount() == 0) {
+        drawText(x_ + 1, y_ + i, "empty", TB_REVERSE);
+        break;
+      }
+      if(i + scrollTop > dir_.getCount() - 1) break;
+
+      drawRow(i, scrollTop);
+    }
+  }
+
+  void drawRow(int i, int scrollTop) {
+    const auto& fileInfo = dir_.at(i + scrollTop);
+
+    if(!selectedFiles_.empty() && isSelectedFile(fileInfo))
+      drawText(x_, y_ + i, " ", 0, TB_MAGENTA);
+
+    int color = getColor(fileInfo);
+    if(i + scrollTop == cursorPos_)
+      color = color | TB_REVERSE;
+
+    if(viewType_ == ViewType::SIMPLE) {
+      drawFileName(x_ + 1, y_ + i, fileInfo, width_, color, 0);
+    }
+    else {
+      char info[256];
+      bool calculating = dirSizeMode_ && fileInfo.isDir() &&
+        !fileInfo.isLink() && !fileInfo.hasDirSize();
+
+      snprintf(info, sizeof(info), " %8.8s  %s",
+               calculating ? "..." : fileInfo.getSizeText().c_str(),
+               fileInfo.getMTimeText().c_str());
+
+      int infolen = strlen(info);
+      int len = drawFileName(x_ + 1, y_ + i, fileInfo, width_ - infolen, color, 0);
+
+      for(; len < width_ - infolen; ++len)
+        tb_change_cell(x_ + 1 + len, y_ + i, ' ', color, 0);
+
+      drawUtf8(x_ + 1 + len, y_ + i, info, infolen, color, 0, width_ - len);
+    }
+  }
+
+  int getColor(const FileInfo& fileInfo) const {
+    int color = 0;
+
+    if(fileInfo.isDir())
+      color = TB_BLUE | TB_BOLD;
+
+    if(fileInfo.isExe())
+      color = TB_GREEN | TB_BOLD;
+
+    if(fileInfo.isFifo())
+      color = TB_YELLOW;
+
+    if(fileInfo.isSock())
+      color = TB_MAGENTA | TB_BOLD;
+
+    if(fileInfo.isLink())
+      color = TB_CYAN | TB_BOLD;
+
+    return color;
+  }
+
+  int getGalleryCols() const {
+    return std::max(1, width_ / GALLERY_TILE_W);
+  }
+
+  int getGalleryRows() const {
+    return std::max(1, height_ / GALLERY_TILE_H);
+  }
+
+  // PgUp/PgDn move half a screen: rows of tiles in the gallery view
+  int getScrollStep() const {
+    if(viewType_ == ViewType::GALLERY)
+      return std::max(1, getGalleryRows() / 2) * getGalleryCols();
+
+    return height_ / 2;
+  }
+
+  // the grid of thumbnails. the cells of the grid and the thumbnails are sent
+  // again if redraw is true or the view has scrolled, otherwise only the names
+  // under the old and the new cursor position.
+  void drawGallery(bool redraw) {
+    int cols = getGalleryCols(), rows = getGalleryRows();
+
+    int top = oldScrollTop_ / cols, row = cursorPos_ / cols;
+    if(row < top) top = row;
+    else if(row >= top + rows) top = row - rows + 1;
+    top = std::max(0, std::min(top, (dir_.getCount() + cols - 1) / cols - rows));
+    oldScrollTop_ = top * cols;
+
+    if(!redraw && oldScrollTop_ == drawnScrollTop_ && dir_.getCount() == drawnCount_) {
+      for(auto pos: {drawnCursor_, cursorPos_}) {
+        int slot = pos - drawnScrollTop_;
+        if(slot < 0 || slot >= cols * rows || pos >= dir_.getCount()) continue;
+
+        drawTileName(slot, cols);
+      }
+      drawnCursor_ = cursorPos_;
+      return;
+    }
+
+    drawnScrollTop_ = oldScrollTop_;
+    drawnCursor_ = cursorPos_;
+    drawnCount_ = dir_.getCount();
+
+    for(int i = 0; i < height_; ++i)
+      clearLine(x_, y_ + i, width_ + 1);
+    tb_invalidate(x_, y_, width_ + 1, height_);
+    thumbnailShown_.assign(cols * rows, false);
+    thumbnailsOnScreen_ = true;
+
+    if(dir_.getCount() == 0) {
+      drawText(x_ + 1, y_, "empty", TB_REVERSE);
+      return;
+    }
+
+    // the size of the thumbnails in pixels, none if the terminal does not tell it
+    int termCol, termRow, xpixel, ypixel;
+    getTermSize(&termCol, &termRow, &xpixel, &ypixel);
+    int cw = termCol > 0 ? xpixel / termCol : 0, ch = termRow > 0 ? ypixel / termRow : 0;
+    bool thumbnail = cw > 0 && ch > 0;
+
+    // the visible files first, then the next and the previous page
+    std::vector<FileInfo> files;
+    int page = cols * rows;
+    for(int start: {drawnScrollTop_, drawnScrollTop_ + page, drawnScrollTop_ - page}) {
+      for(int i = std::max(0, start); i < std::min(start + page, dir_.getCount()); ++i) {
+        if(!dir_.at(i).isDir()) files.emplace_back(dir_.at(i));
+      }
+    }
+    if(thumbnail) {
+      thumbnailLoader.request(files, (GALLERY_TILE_W - 2) * cw, (GALLERY_TILE_H - 1) * ch - 6);
+    }
+
+    for(int slot = 0; slot < page && drawnScrollTop_ + slot < dir_.getCount(); ++slot) {
+      const auto& fileInfo = dir_.at(drawnScrollTop_ + slot);
+      int x = x_ + (slot % cols) * GALLERY_TILE_W + 1;
+      int y = y_ + (slot / cols) * GALLERY_TILE_H;
+
+      if(fileInfo.isDir()) {
+        drawText(x, y, "[dir]", getColor(fileInfo));
+        thumbnailShown_[slot] = true;
+      }
+      else if(thumbnail) drawText(x, y, "...");
+      else thumbnailShown_[slot] = true;
+
+      drawTileName(slot, cols);
+    }
+
+    drawThumbnails();
+  }
+
+  void drawTileName(int slot, int cols) {
+    int pos = drawnScrollTop_ + slot;
+    const auto& fileInfo = dir_.at(pos);
+    int x = x_ + (slot % cols) * GALLERY_TILE_W;
+    int y = y_ + (slot / cols) * GALLERY_TILE_H + GALLERY_TILE_H - 1;
+
+    clearLine(x, y, GALLERY_TILE_W);
+    if(!selectedFiles_.empty() && isSelectedFile(fileInfo))
+      drawText(x, y, " ", 0, TB_MAGENTA);
+
+    int color = getColor(fileInfo);
+    if(pos == cursorPos_)
+      color = color | TB_REVERSE;
+
+    drawFileName(x + 1, y, fileInfo, GALLERY_TILE_W - 2, color, 0);
+  }
+
+  // the cells under the thumbnails are sent again with the next tb_present()
+  void eraseThumbnails() {
+    if(!thumbnailsOnScreen_) return;
+
+    tb_invalidate(x_, y_, width_ + 1, height_);
+    thumbnailsOnScreen_ = false;
+    thumbnailShown_.clear();
+  }
+
+  std::string findUpDirName(const std::string& path) {
+    auto dir = opendir(path.c_str());
+    if(dir == NULL) {
+      if(path == "/") return "/";
+
+      auto i = path.find_last_of('/', path.length() - 2);
+      if(i != std::string::npos) {
+        return findUpDirName(path.substr(0, i) + "/");
+      }
+      else return "/";
+    }
+    closedir(dir);
+
+    return path;
+  }
+
+  // a tile of the gallery view is a thumbnail and the file name under it
+  static const int GALLERY_TILE_W = 12;
+  static const int GALLERY_TILE_H = 6;
+
+  DirInfo dir_;
+  std::string path_, lastPath_;
+  static tsl::robin_set<std::string> selectedFiles_;
+  int x_, y_;
+  int width_, height_, cursorPos_;
+  int oldScrollTop_;
+  int drawnScrollTop_, drawnCursor_, drawnCount_;
+  bool scroll_;
+  bool dirSizeMode_;
+  bool searchMode_, grepMode_, truncated_;
+  std::string searchQuery_;
+  std::unique_ptr<FileSearch> search_;
+  std::unique_ptr<ContentSearch> grep_;
+  std::chrono::steady_clock::time_point lastSearchUpdate_;
+  ViewType viewType_;
+  std::vector<bool> thumbnailShown_;
+  static bool thumbnailsOnScreen_;
+};
+
+tsl::robin_set<std::string> FileView::selectedFiles_;
+bool FileView::thumbnailsOnScreen_ = false;
+
+/*
+ * Append-only record of the copy/move/delete jobs (~/.config/Minase/journal).
+ *
+ *   Q <pid> <id> <operation> <src> <dst> <existed> <owner> : queued
+ *   R <pid> <id>                         : running
+ *   D <pid> <id>                         : done
+ *   C <pid> <id>                         : cancelled
+ *
+ * Fields are separated by tabs. A job of a process that is gone and never
+ * reached D or C was interrupted and can be resumed. pids are reused (after
+ * a reboot almost surely), so owner is the boot id and the start time of
+ * the process, and the process is running only if both still match.
+ */
+class Journal {
+public:
+  struct Entry {
+    pid_t pid;
+    int id;
+    int operation;
+    std::string src, dst;
+    // the target of a copy/move existed when the job was queued
+    bool existed;
+    // "<boot id>/<start time>" of the process, empty: unknown
+    std::string owner;
+  };
+
+  Journal() : owner_(getOwner(getpid())) {}
+
+  void setPath(const std::string& path) { path_ = path; }
+
+  void queued(int id, int operation, const std::string& src, const std::string& dst, bool existed) {
+    append(queuedRecord(getpid(), id, operation, src, dst, existed, owner_));
+  }
+  void running(int id) { append(record('R', id)); }
+  void done(int id) { append(record('D', id)); }
+  void cancelled(int id) { append(record('C', id)); }
+
+  std::vector<Entry> getInterrupted() {
+    std::vector<Entry> result;
+
+    int fd = lock();
+    if(fd == -1) return result;
+
+    std::vector<Entry> entries;
+    std::vector<bool> live;
+    read(fd, entries, live);
+    close(fd);
+
+    for(size_t i = 0; i < entries.size(); ++i) {
+      if(!live[i]) result.emplace_back(entries[i]);
+    }
+
+    return result;
+  }
+
+  // drop everything except the unfinished jobs of other running instances
+  void compact() {
+    int fd = lock();
+    if(fd == -1) return;
+
+    std::vector<Entry> entries;
+    std::vector<bool> live;
+    read(fd, entries, live);
+
+    std::string buf;
+    for(size_t i = 0; i < entries.size(); ++i) {
+      if(!live[i]) continue;
+
+      const auto& e = entries[i];
+      buf += queuedRecord(e.pid, e.id, e.operation, e.src, e.dst, e.existed, e.owner);
+    }
 
-    if(!scroll_) {
-      if(oldScrollTop_ + height_ - y_ < cursorPos_) ++oldScrollTop_;
-      else if(oldScrollTop_ > cursorPos_) --oldScrollTop_;
+    auto tmp = path_ + ".tmp";
+    int tfd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(tfd != -1) {
+      bool ok = writeAll(tfd, buf) && fsync(tfd) == 0;
+      close(tfd);
 
-      if(height_ > dir_.getCount() - 1) {
-        oldScrollTop_ = 0;
-      }
-      scrollTop = oldScrollTop_;
+      if(ok) rename(tmp.c_str(), path_.c_str());
+      else unlink(tmp.c_str());
     }
-    oldScrollTop_ = scrollTop;
 
-    for(auto i = 0; i < height_; ++i) {
-      if(dir_.getCount() == 0) {
-        drawText(x_ + 1, y_ + i, "empty", TB_REVERSE);
-        break;
-      }
-      if(i + scrollTop > dir_.getCount() - 1) break;
+    close(fd);
+  }
 
-      int color = 0;
-      auto fileInfo = dir_.at(i + scrollTop);
+private:
+  static std::string queuedRecord(pid_t pid, int id, int operation, const std::string& src,
+                                  const std::string& dst, bool existed, const std::string& owner) {
+    return "Q\t" + std::to_string(pid) + "\t" + std::to_string(id) + "\t" +
+      std::to_string(operation) + "\t" + escape(src) + "\t" + escape(dst) + "\t" +
+      (existed ? "1" : "0") + "\t" + owner + "\n";
+  }
 
-      if(isSelectedFile(fileInfo))
-        drawText(x_, y_ + i, " ", 0, TB_MAGENTA);
+  // the boot id and the start time (field 22 of /proc/<pid>/stat) of a
+  // process, empty if it is not running or there is no /proc
+  static std::string getOwner(pid_t pid) {
+    static const std::string bootId = [] {
+      std::ifstream ifs("/proc/sys/kernel/random/boot_id");
+      std::string id;
+      std::getline(ifs, id);
+      return id;
+    }();
+    if(bootId.empty()) return "";
 
-      if(fileInfo.isDir())
-        color = TB_BLUE | TB_BOLD;
+    std::ifstream ifs("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if(!std::getline(ifs, stat)) return "";
 
-      if(fileInfo.isExe())
-        color = TB_GREEN | TB_BOLD;
+    // the command name may contain spaces and parentheses
+    auto pos = stat.rfind(')');
+    if(pos == std::string::npos) return "";
+
+    std::stringstream ss{stat.substr(pos + 1)};
+    std::string field;
+    for(int i = 3; i <= 22; ++i) {
+      if(!(ss >> field)) return "";
+    }
 
-      if(fileInfo.isFifo())
-        color = TB_YELLOW;
+    return bootId + "/" + field;
+  }
 
-      if(fileInfo.isSock())
-        color = TB_MAGENTA | TB_BOLD;
+  bool isRunning(const Entry& e) const {
+    if(!e.owner.empty()) return getOwner(e.pid) == e.owner;
 
-      if(fileInfo.isLink())
-        color = TB_CYAN | TB_BOLD;
+    // a record of an old version or of a system without /proc
+    return e.pid == getpid() || kill(e.pid, 0) == 0 || errno == EPERM;
+  }
 
-      if(i + scrollTop == cursorPos_)
-        color = color | TB_REVERSE;
+  std::string record(char type, int id) const {
+    return std::string(1, type) + "\t" + std::to_string(getpid()) + "\t" + std::to_string(id) + "\n";
+  }
 
-      if(viewType_ == ViewType::SIMPLE) {
-        drawText(x_ + 1, y_ + i, strimFileName(fileInfo, width_), color, 0);
-      }
-      else {
-        char info[256];
-        snprintf(info, sizeof(info), " %8.8s  %s",
-                 FileInfo::getSizeStr(fileInfo).c_str(),
-                 FileInfo::getMTimeStr(fileInfo).c_str());
-
-        int infolen = strlen(info);
-        int len = 0;
-        std::string txt = strimFileName(fileInfo, width_ - infolen, &len);
-        txt.pop_back();
-
-        if(width_ - infolen - len > 0) {
-          for(int i = 0; i < static_cast<int>(width_ - infolen) - len; ++i)
-            txt.push_back(' ');
-        }
+  static std::string escape(const std::string& str) {
+    std::string result;
 
-        txt += info;
-        drawText(x_ + 1, y_ + i, txt, color, 0, width_);
-      }
+    for(auto c: str) {
+      if(c == '\\') result += "\\\\";
+      else if(c == '\t') result += "\\t";
+      else if(c == '\n') result += "\\n";
+      else result += c;
     }
+
+    return result;
   }
 
-  std::string strimFileName(const FileInfo& fileInfo, int w, int* len = 0) const {
-    int llen;
+  static std::string unescape(const std::string& str) {
     std::string result;
-    if(config.useIcon()) {
-      result = strimwidth(getIcon(fileInfo) + " " + fileInfo.getFileName(), w, &llen);
+
+    for(size_t i = 0; i < str.length(); ++i) {
+      if(str[i] == '\\' && i + 1 < str.length()) {
+        ++i;
+        if(str[i] == 't') result += '\t';
+        else if(str[i] == 'n') result += '\n';
+        else result += str[i];
+      }
+      else result += str[i];
     }
-    else {
-      result = strimwidth(fileInfo.getFileName(), w, &llen);
+
+    return result;
+  }
+
+  static bool writeAll(int fd, const std::string& buf) {
+    size_t n = 0;
+
+    while(n < buf.length()) {
+      auto r = write(fd, buf.data() + n, buf.length() - n);
+      if(r < 0) {
+        if(errno == EINTR) continue;
+        return false;
+      }
+      n += r;
     }
 
-    if(result.length() - 1 < fileInfo.getFileName().length()) {
-      auto suffix = fileInfo.getSuffix();
-      if(suffix.empty() || (llen - (suffix.length() + 2) < 0)) {
-        if(len != 0) *len = llen;
-        return result;
+    return true;
+  }
+
+  // Open and flock the journal. compact() replaces the file, so retry if the
+  // locked inode is no longer the one at path_.
+  int lock() const {
+    if(path_.empty()) return -1;
+
+    while(1) {
+      int fd = open(path_.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+      if(fd == -1) return -1;
+
+      if(flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return -1;
       }
 
-      int len2;
-      result = strimwidth(result, llen - (suffix.length() + 2), &len2);
-      result.pop_back();
+      struct stat a, b;
+      if(fstat(fd, &a) == 0 && stat(path_.c_str(), &b) == 0 &&
+         a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+        return fd;
 
-      result += "~." + suffix + '\0';
-      llen = len2 + (suffix.length() + 2);
+      close(fd);
     }
+  }
 
-    if(len != 0) *len = llen;
-    return result;
+  void append(const std::string& rec) {
+    int fd = lock();
+    if(fd == -1) return;
+
+    if(writeAll(fd, rec)) fdatasync(fd);
+    close(fd);
   }
 
-private:
-  std::string findUpDirName(const std::string& path) {
-    auto dir = opendir(path.c_str());
-    if(dir == NULL) {
-      if(path == "/") return "/";
+  // unfinished jobs in queue order; live[i] is true if the owner is running
+  void read(int fd, std::vector<Entry>& entries, std::vector<bool>& live) const {
+    std::string buf;
+    char rbuf[4096];
 
-      auto i = path.find_last_of('/', path.length() - 2);
-      if(i != std::string::npos) {
-        return findUpDirName(path.substr(0, i) + "/");
+    lseek(fd, 0, SEEK_SET);
+    while(1) {
+      auto r = ::read(fd, rbuf, sizeof(rbuf));
+      if(r < 0 && errno == EINTR) continue;
+      if(r <= 0) break;
+      buf.append(rbuf, r);
+    }
+
+    std::stringstream ss{buf};
+    std::string line;
+    while(std::getline(ss, line)) {
+      std::vector<std::string> fields;
+      std::stringstream ls{line};
+      std::string field;
+
+      while(std::getline(ls, field, '\t')) fields.emplace_back(field);
+      if(fields.size() < 3 || fields[0].length() != 1) continue;
+
+      Entry e;
+      e.pid = atoi(fields[1].c_str());
+      e.id = atoi(fields[2].c_str());
+
+      if(fields[0][0] == 'Q') {
+        if(fields.size() < 5) continue;
+
+        e.operation = atoi(fields[3].c_str());
+        e.src = unescape(fields[4]);
+        e.dst = fields.size() > 5 ? unescape(fields[5]) : "";
+        // an old journal does not tell, so nothing in the target is removed
+        e.existed = fields.size() > 6 ? fields[6] != "0" : true;
+        if(fields.size() > 7) e.owner = fields[7];
+        entries.emplace_back(e);
+      }
+      else if(fields[0][0] == 'D' || fields[0][0] == 'C') {
+        for(auto it = entries.begin(); it != entries.end(); ++it) {
+          if(it -> pid == e.pid && it -> id == e.id) {
+            entries.erase(it);
+            break;
+          }
+        }
       }
-      else return "/";
     }
-    closedir(dir);
 
-    return path;
+    live.clear();
+    for(const auto& e: entries) {
+      live.push_back(isRunning(e));
+    }
   }
 
-  DirInfo dir_;
-  std::string path_, lastPath_;
-  static tsl::robin_set<std::string> selectedFiles_;
-  int x_, y_;
-  int width_, height_, cursorPos_;
-  int oldScrollTop_;
-  bool scroll_;
-  ViewType viewType_;
+  std::string path_;
+  std::string owner_;
 };
 
-tsl::robin_set<std::string> FileView::selectedFiles_;
-
 class FileOperation {
 public:
   FileOperation() {
     operation_ = false;
     logTextUpDate_ = false;
+    jobUpdate_ = false;
     taskCnt_ = 0;
+    pid_ = 0;
     kill_ = false;
+    lastId_ = 0;
+    cancelId_ = 0;
+
+    auto home = getenv("HOME");
+    if(home != 0) {
+      std::string dir = std::string(home) + "/.config";
+      mkdir(dir.c_str(), 0755);
+      dir += "/Minase";
+      mkdir(dir.c_str(), 0755);
+
+      journal_.setPath(dir + "/journal");
+    }
   }
 
   ~FileOperation() {
     kill_ = true;
+    {
+      std::lock_guard<std::mutex> lock(taskMutex_);
+      if(currentTask_.paused) {
+        int pid = pid_;
+        if(pid > 0) kill(pid, SIGCONT);
+      }
+    }
     if(thread_.joinable()) {
       thread_.join();
     }
@@ -2224,6 +5623,10 @@ public:
     task.operation = Task::FILE_COPY;
     task.src = src;
     task.dst = dst;
+    task.id = ++lastId_;
+
+    struct stat st;
+    task.existed = lstat(getCopyTarget(task).c_str(), &st) == 0;
 
     ++taskCnt_;
     addTask(task);
@@ -2235,6 +5638,10 @@ public:
     task.operation = Task::FILE_MOVE;
     task.src = src;
     task.dst = dst;
+    task.id = ++lastId_;
+
+    struct stat st;
+    task.existed = lstat(getCopyTarget(task).c_str(), &st) == 0;
 
     ++taskCnt_;
     addTask(task);
@@ -2246,6 +5653,7 @@ public:
     task.operation = Task::FILE_DELETE;
     task.src = fileName;
     task.dst = "";
+    task.id = ++lastId_;
 
     ++taskCnt_;
     addTask(task);
@@ -2309,91 +5717,454 @@ public:
     else
       addLogMessage("Can't create to file/dir: " + path + name);
 
-    return result != -1;
+    return result != -1;
+  }
+
+  int getTaskCount() const {
+    return taskCnt_;
+  }
+
+  struct Task {
+    Task() : operation(NONE), id(0), running(false), paused(false), resume(false), existed(false) {}
+
+    enum Operation {
+      NONE,
+      FILE_COPY,
+      FILE_MOVE,
+      FILE_DELETE,
+      RELOAD,
+      START,
+      ADD_LOGTEXT,
+    } operation;
+
+    std::string src;
+    std::string dst;
+
+    // id != 0: copy/move/delete job that can be controlled from the log view
+    int id;
+    bool running, paused;
+    // restarted from the journal: skip what was already done
+    bool resume;
+    // the target of a copy/move existed when the job was queued
+    bool existed;
+
+    std::string getJobText() const {
+      std::string txt = "#" + std::to_string(id);
+
+      if(running) txt += paused ? " [pause]" : " [run]  ";
+      else txt += paused ? " [pause]" : " [wait] ";
+      if(resume) txt += " resume";
+
+      switch(operation) {
+      case FILE_COPY:
+        txt += " copy: " + src + " -> " + dst;
+        break;
+      case FILE_MOVE:
+        txt += " move: " + src + " -> " + dst;
+        break;
+      case FILE_DELETE:
+        txt += " delete: " + src;
+        break;
+      default:
+        break;
+      };
+
+      return txt;
+    }
+  };
+
+  std::vector<Task> getJobs() {
+    std::lock_guard<std::mutex> lock(taskMutex_);
+    std::vector<Task> jobs;
+    jobUpdate_ = false;
+
+    if(currentTask_.id != 0) jobs.emplace_back(currentTask_);
+    for(const auto& task: taskQueue_) {
+      if(task.id != 0) jobs.emplace_back(task);
+    }
+
+    return jobs;
+  }
+
+  bool isJobUpdate() const {
+    return jobUpdate_;
+  }
+
+  std::vector<Journal::Entry> getInterruptedJobs() {
+    return journal_.getInterrupted();
+  }
+
+  // requeue (resume == true) or forget the jobs left over from an earlier run
+  void resumeJobs(const std::vector<Journal::Entry>& jobs, bool resume) {
+    journal_.compact();
+    if(!resume || jobs.empty()) return;
+
+    startTask();
+    addLogMessage("resume " + std::to_string(jobs.size()) + " interrupted job(s)");
+
+    std::vector<std::string> paths;
+    for(const auto& e: jobs) {
+      Task task;
+
+      task.operation = static_cast<Task::Operation>(e.operation);
+      if(task.operation != Task::FILE_COPY && task.operation != Task::FILE_MOVE &&
+         task.operation != Task::FILE_DELETE) continue;
+
+      task.src = e.src;
+      task.dst = e.dst;
+      task.id = ++lastId_;
+      task.resume = true;
+      task.existed = e.existed;
+
+      ++taskCnt_;
+      addTask(task);
+
+      auto path = task.operation == Task::FILE_DELETE ? getDirName(task.src) + "/" : task.dst;
+      if(std::find(paths.begin(), paths.end(), path) == paths.end())
+        paths.emplace_back(path);
+    }
+
+    for(const auto& path: paths) reloadPath(path);
+  }
+
+  bool cancelJob(int id) {
+    std::unique_lock<std::mutex> lock(taskMutex_);
+
+    if(currentTask_.id == id) {
+      if(cancelId_ == id) return true;
+      cancelId_ = id;
+
+      int pid = pid_;
+      if(pid > 0) {
+        kill(pid, SIGTERM);
+        if(currentTask_.paused) kill(pid, SIGCONT);
+      }
+      currentTask_.paused = false;
+      jobUpdate_ = true;
+
+      return true;
+    }
+
+    for(auto it = taskQueue_.begin(); it != taskQueue_.end(); ++it) {
+      if(it -> id == id) {
+        auto text = it -> getJobText();
+        taskQueue_.erase(it);
+        --taskCnt_;
+        jobUpdate_ = true;
+        lock.unlock();
+
+        journal_.cancelled(id);
+        addLogText("cancel: " + text);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool pauseJob(int id, bool pause) {
+    std::lock_guard<std::mutex> lock(taskMutex_);
+
+    if(currentTask_.id == id) {
+      if(currentTask_.paused == pause || cancelId_ == id) return false;
+
+      int pid = pid_;
+      if(pid > 0) kill(pid, pause ? SIGSTOP : SIGCONT);
+      currentTask_.paused = pause;
+      jobUpdate_ = true;
+
+      return true;
+    }
+
+    for(auto&& task: taskQueue_) {
+      if(task.id == id) {
+        if(task.paused == pause) return false;
+
+        task.paused = pause;
+        jobUpdate_ = true;
+        if(!pause) startThreadNL();
+
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // move a queued job before (n < 0) or after (n > 0) the neighbouring job
+  bool moveJob(int id, int n) {
+    std::lock_guard<std::mutex> lock(taskMutex_);
+
+    int pos = -1;
+    for(int i = 0; i < static_cast<int>(taskQueue_.size()); ++i) {
+      if(taskQueue_[i].id == id) {
+        pos = i;
+        break;
+      }
+    }
+    if(pos == -1) return false;
+
+    int step = n < 0 ? -1 : 1;
+    for(int i = pos + step; i >= 0 && i < static_cast<int>(taskQueue_.size()); i += step) {
+      if(taskQueue_[i].id != 0) {
+        std::swap(taskQueue_[pos], taskQueue_[i]);
+        jobUpdate_ = true;
+
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  std::deque<std::string> getLogText() {
+    std::lock_guard<std::mutex> lock(logMutex_);
+    logTextUpDate_ = false;
+    return logText_;
+  }
+
+  bool isLogTextUpdate() const {
+    return logTextUpDate_;
+  }
+
+  bool hasReloadPath() {
+    std::lock_guard<std::mutex> lock(reloadMutex_);
+
+    if(reloadPathQueue_.empty()) return false;
+    return true;
+  }
+
+  std::string getReloadPath() {
+    std::lock_guard<std::mutex> lock(reloadMutex_);
+    if(reloadPathQueue_.empty()) return "";
+
+    auto path = reloadPathQueue_.front();
+    reloadPathQueue_.pop();
+
+    return path;
+  }
+
+private:
+  // output gets the lines printed by the command, without the newline
+  int exec(const std::string& cmd, const std::vector<std::string>& args,
+           std::vector<std::string>* output = 0) {
+    std::vector<std::string> argv{cmd};
+    argv.insert(argv.end(), args.begin(), args.end());
+
+    Process process;
+    if(!process.start(argv, Process::PIPE_STDERR)) {
+      perror("can not exec command");
+      return -1;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(taskMutex_);
+      pid_ = process.getPid();
+      if(cancelId_ != 0 && cancelId_ == currentTask_.id) kill(pid_, SIGTERM);
+      else if(currentTask_.paused) kill(pid_, SIGSTOP);
+    }
+
+    std::string text;
+    bool more = true;
+    while(more) {
+      more = process.read(text);
+
+      size_t start = 0, end;
+      while((end = text.find('\n', start)) != std::string::npos) {
+        addLogText(text.substr(start, end + 1 - start));
+        if(output != 0) output -> emplace_back(text.substr(start, end - start));
+        start = end + 1;
+      }
+      text.erase(0, start);
+    }
+    if(!text.empty()) {
+      addLogText(text);
+      if(output != 0) output -> emplace_back(text);
+    }
+
+    {
+      // the child is a zombie until it is reaped, so its pid can't be reused
+      // by the time cancelJob/pauseJob sees pid_ == 0
+      std::lock_guard<std::mutex> lock(taskMutex_);
+      pid_ = 0;
+    }
+
+    return process.wait();
+  }
+
+  static std::string removeTrailingSlash(const std::string& path) {
+    auto result = path;
+    if(result.length() > 1 && result.back() == '/') result.pop_back();
+
+    return result;
+  }
+
+  static std::string getCopyTarget(const Task& task) {
+    auto src = removeTrailingSlash(task.src);
+
+    auto dst = task.dst;
+    if(dst.empty() || dst.back() != '/') dst.push_back('/');
+
+    return dst + getBaseName(src);
+  }
+
+  static bool isSameContent(const std::string& a, const std::string& b) {
+    int fa = open(a.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fa == -1) return false;
+
+    int fb = open(b.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fb == -1) {
+      close(fa);
+      return false;
+    }
+
+    bool result = true;
+    std::vector<char> bufA(65536), bufB(65536);
+    while(1) {
+      auto ra = read(fa, bufA.data(), bufA.size());
+      auto rb = read(fb, bufB.data(), bufB.size());
+
+      if(ra != rb || ra < 0 || memcmp(bufA.data(), bufB.data(), ra) != 0) {
+        result = false;
+        break;
+      }
+      if(ra == 0) break;
+    }
+
+    close(fa);
+    close(fb);
+
+    return result;
   }
 
-  int getTaskCount() const {
-    return taskCnt_;
+  // true if the file target is a complete copy of src: the same size and
+  // mtime (cp -p keeps the mtime) and optionally the same content
+  static bool isSameFile(const std::string& src, const struct stat& s,
+                         const std::string& target, const struct stat& t) {
+    return s.st_size == t.st_size &&
+      s.st_mtim.tv_sec == t.st_mtim.tv_sec && s.st_mtim.tv_nsec == t.st_mtim.tv_nsec &&
+      (!config.resumeCompareContent() || isSameContent(src, target));
   }
 
-  struct Task {
-    enum Operation {
-      NONE,
-      FILE_COPY,
-      FILE_MOVE,
-      FILE_DELETE,
-      RELOAD,
-      START,
-      ADD_LOGTEXT,
-    } operation;
+  // Take away the files under target that don't match src, so "cp -u" only
+  // copies what is missing. They are removed if the whole target was made by
+  // this job, otherwise they may be the user's files and are kept as a
+  // backup like "cp -b" does.
+  void removeIncompleteFiles(const Task& task, const std::string& src, const std::string& target) {
+    struct stat s, t;
+    if(lstat(src.c_str(), &s) != 0 || lstat(target.c_str(), &t) != 0) return;
 
-    std::string src;
-    std::string dst;
-  };
+    if(S_ISDIR(s.st_mode) && S_ISDIR(t.st_mode)) {
+      auto dir = opendir(src.c_str());
+      if(dir == NULL) return;
 
-  std::deque<std::string> getLogText() {
-    std::lock_guard<std::mutex> lock(logMutex_);
-    logTextUpDate_ = false;
-    return logText_;
-  }
+      struct dirent* dp;
+      while((dp = readdir(dir)) != NULL) {
+        if((dp -> d_name[0] == '.' && (dp -> d_name[1] == 0 || (dp -> d_name[1] == '.' && dp -> d_name[2] == 0))))
+          continue;
+        if(kill_ || isCancelRequested(task)) break;
 
-  bool isLogTextUpdate() const {
-    return logTextUpDate_;
+        removeIncompleteFiles(task, src + "/" + dp -> d_name, target + "/" + dp -> d_name);
+      }
+      closedir(dir);
+    }
+    else if(S_ISREG(s.st_mode) && S_ISREG(t.st_mode) && !isSameFile(src, s, target, t)) {
+      if(!task.existed) {
+        if(unlink(target.c_str()) == 0) addLogText("incomplete: " + target);
+        return;
+      }
+
+      // target~, or target.~N~ if that is taken
+      auto backup = target + "~";
+      for(int n = 1; lstat(backup.c_str(), &t) == 0; ++n)
+        backup = target + ".~" + std::to_string(n) + "~";
+
+      if(rename(target.c_str(), backup.c_str()) == 0)
+        addLogText("backup: " + target + " -> " + backup);
+    }
   }
 
-  bool hasReloadPath() {
-    std::lock_guard<std::mutex> lock(reloadMutex_);
+  // a name quoted by "cp -v": 'name', or "name" if it contains a '. false
+  // for the escaped forms, which are not decoded
+  static bool parseQuoted(const std::string& line, size_t& pos, std::string& name) {
+    if(pos >= line.length() || (line[pos] != '\'' && line[pos] != '"')) return false;
 
-    if(reloadPathQueue_.empty()) return false;
+    auto end = line.find(line[pos], pos + 1);
+    if(end == std::string::npos) return false;
+
+    name = line.substr(pos + 1, end - pos - 1);
+    if(line[pos] == '"' && name.find_first_of("\\$`") != std::string::npos) return false;
+
+    pos = end + 1;
     return true;
   }
 
-  std::string getReloadPath() {
-    std::lock_guard<std::mutex> lock(reloadMutex_);
-    if(reloadPathQueue_.empty()) return "";
+  // Undo what a cancelled "cp -bv" printed it has done under target: the
+  // files it made are removed and the ones it backed up are put back. false
+  // if a line can not be read or undone.
+  bool removeCopiedFiles(const std::string& target, const std::vector<std::string>& output) {
+    bool result = true;
 
-    auto path = reloadPathQueue_.front();
-    reloadPathQueue_.pop();
+    // the files of a directory are printed after it
+    for(auto it = output.rbegin(); it != output.rend(); ++it) {
+      const auto& line = *it;
+      std::string src, dst, backup;
+      size_t pos = 0;
 
-    return path;
-  }
+      if(!parseQuoted(line, pos, src) || line.compare(pos, 4, " -> ") != 0 ||
+         !parseQuoted(line, pos += 4, dst) ||
+         (pos < line.length() && (line.compare(pos, 10, " (backup: ") != 0 ||
+                                  !parseQuoted(line, pos += 10, backup) || line.substr(pos) != ")"))) {
+        result = false;
+        continue;
+      }
+      if(dst != target && dst.compare(0, target.length() + 1, target + "/") != 0) continue;
 
-private:
-  void exec(const std::string& cmd, const std::vector<std::string>& args) {
-    int pipefd = 1;
-    pid_ = popen2(cmd, args, 0, &pipefd, true);
-    if(pid_ < 0) {
-      perror("can not exec command");
-      return;
+      struct stat s;
+      if(!backup.empty()) {
+        if(rename(backup.c_str(), dst.c_str()) != 0) result = false;
+      }
+      else if(lstat(dst.c_str(), &s) == 0) {
+        // a directory is only made by cp if it was not there
+        if(S_ISDIR(s.st_mode) ? rmdir(dst.c_str()) != 0 : unlink(dst.c_str()) != 0) result = false;
+      }
     }
 
-    FILE* fp;
-    if((fp = fdopen(pipefd, "r")) == NULL) {
-      perror("fdopen");
+    return result;
+  }
 
-      close(pipefd);
-      pclose2(pid_);
-      pid_ = 0;
+  // true if every file under src is in target (complete if it is a regular
+  // file), so the source of a resumed move can be removed
+  bool isCopied(const Task& task, const std::string& src, const std::string& target) {
+    struct stat s, t;
+    if(lstat(src.c_str(), &s) != 0 || lstat(target.c_str(), &t) != 0) return false;
+    if((s.st_mode & S_IFMT) != (t.st_mode & S_IFMT)) return false;
 
-      return;
-    }
+    if(S_ISREG(s.st_mode)) return isSameFile(src, s, target, t);
+    if(!S_ISDIR(s.st_mode)) return true;
 
-    char rbuf[4096];
-    while(!feof(fp)) {
-      if(fgets(rbuf, sizeof(rbuf), fp) != 0)
-        addLogText(rbuf);
+    auto dir = opendir(src.c_str());
+    if(dir == NULL) return false;
+
+    bool result = true;
+    struct dirent* dp;
+    while(result && (dp = readdir(dir)) != NULL) {
+      if((dp -> d_name[0] == '.' && (dp -> d_name[1] == 0 || (dp -> d_name[1] == '.' && dp -> d_name[2] == 0))))
+        continue;
+      if(kill_ || isCancelRequested(task)) result = false;
+      else result = isCopied(task, src + "/" + dp -> d_name, target + "/" + dp -> d_name);
     }
+    closedir(dir);
 
-    pclose2(pid_);
-    fclose(fp);
-    close(pipefd);
-    pid_ = 0;
+    return result;
   }
 
   void impl() {
-    while(!taskEmpty()) {
-      auto task = getTask();
-      operation_ = true;
+    Task task;
+
+    while(getTask(task)) {
+      if(task.id != 0) journal_.running(task.id);
+      bool cancelled = false;
 
       switch(task.operation) {
       case Task::NONE:
@@ -2401,25 +6172,85 @@ private:
 
       case Task::FILE_COPY:
       case Task::FILE_MOVE:
-        if(task.operation == Task::FILE_COPY){
-          std::vector<std::string> args{"-bfvrp", task.src, task.dst};
-          exec("cp", args);
-        }
-        else {
-          std::vector<std::string> args{"-bfv", task.src, task.dst};
-          exec("mv", args);
+        {
+          struct stat s;
+          auto target = getCopyTarget(task);
+          bool exists = lstat(target.c_str(), &s) == 0;
+          std::vector<std::string> copied;
+
+          if(task.resume && exists) {
+            auto src = removeTrailingSlash(task.src);
+
+            if(lstat(src.c_str(), &s) != 0) {
+              addLogText("already done: " + task.getJobText());
+            }
+            else {
+              removeIncompleteFiles(task, src, target);
+
+              // what is left in target matches src by mtime, so -u copies
+              // only the missing files. cp's exit status is not used, some
+              // versions fail when they skip a file.
+              std::vector<std::string> args{"-rpvu", task.src, task.dst};
+              exec("cp", args);
+
+              if(task.operation == Task::FILE_MOVE && !isCancelRequested(task)) {
+                if(isCopied(task, src, target)) {
+                  std::vector<std::string> args{"-rf", task.src};
+                  exec("rm", args);
+                }
+                else addLogText("incomplete, source kept: " + src);
+              }
+            }
+          }
+          else if(task.operation == Task::FILE_COPY){
+            std::vector<std::string> args{"-bfvrp", task.src, task.dst};
+            exec("cp", args, &copied);
+          }
+          else {
+            std::vector<std::string> args{"-bfv", task.src, task.dst};
+            exec("mv", args);
+          }
+
+          if((cancelled = isCancelled(task))) {
+            addLogText("cancel: " + task.getJobText());
+
+            // Only a copy is safe to roll back. A cross-device mv may already
+            // have removed part of the source.
+            if(task.operation == Task::FILE_COPY && !exists &&
+               lstat(target.c_str(), &s) == 0) {
+              std::vector<std::string> args{"-rf", target};
+              exec("rm", args);
+              addLogText("remove partial copy: " + target);
+            }
+            else if(task.operation == Task::FILE_COPY && exists) {
+              // merged into the user's files, only what this job made is undone
+              if(!task.resume && removeCopiedFiles(target, copied))
+                addLogText("remove partial copy in: " + target);
+              else
+                addLogText("partial copy left in: " + target);
+            }
+            else if(task.operation == Task::FILE_MOVE) {
+              addLogText("check partial move: " + target);
+            }
+          }
         }
         --taskCnt_;
         break;
 
       case Task::FILE_DELETE:
         {
+          struct stat s;
           std::vector<std::string> args{"-vrf", task.src, task.dst};
 
-          if(config.useTrash())
+          if(task.resume && lstat(task.src.c_str(), &s) != 0)
+            addLogText("already done: " + task.getJobText());
+          else if(config.useTrash())
             exec("trash-put", args);
           else
             exec("rm", args);
+
+          if((cancelled = isCancelled(task)))
+            addLogText("cancel: " + task.getJobText());
         }
         --taskCnt_;
         break;
@@ -2437,14 +6268,30 @@ private:
         break;
 
       };
-      operation_ = false;
-      if(kill_) break;
+
+      if(task.id != 0) {
+        if(cancelled) journal_.cancelled(task.id);
+        else journal_.done(task.id);
+      }
     }
   }
 
-  bool taskEmpty() {
+  bool isCancelRequested(const Task& task) {
+    std::lock_guard<std::mutex> lock(taskMutex_);
+    return task.id != 0 && cancelId_ == task.id;
+  }
+
+  // true if the running job was cancelled. The job is dropped from the job
+  // list so that the cleanup that follows can't be cancelled again.
+  bool isCancelled(const Task& task) {
     std::lock_guard<std::mutex> lock(taskMutex_);
-    return taskQueue_.empty();
+    if(task.id == 0 || cancelId_ != task.id) return false;
+
+    currentTask_.id = 0;
+    cancelId_ = 0;
+    jobUpdate_ = true;
+
+    return true;
   }
 
   int getTaskQueueCount() {
@@ -2452,29 +6299,49 @@ private:
     return taskQueue_.size();
   }
 
+  void startThreadNL() {
+    if(!operation_) {
+      if(thread_.joinable()) thread_.join();
+      operation_ = true;
+      thread_ = std::thread(&FileOperation::impl, this);
+    }
+  }
+
   void addTask(const Task& task) {
+    if(task.id != 0) journal_.queued(task.id, task.operation, task.src, task.dst, task.existed);
+
     std::lock_guard<std::mutex> lock(taskMutex_);
-    if(taskQueue_.size() != 0)
-      taskQueue_.push(task);
-    else {
-      if(!operation_) {
-        if(thread_.joinable()) thread_.join();
-        taskQueue_.push(task);
-        thread_ = std::thread(&FileOperation::impl, this);
-      }
-      else {
-        taskQueue_.push(task);
-      }
-    }
+    taskQueue_.push_back(task);
+    if(task.id != 0) jobUpdate_ = true;
+
+    startThreadNL();
   }
 
-  Task getTask() {
+  // Take the first task that is not paused. Returns false (and lets the
+  // worker thread finish) when only paused tasks are left.
+  bool getTask(Task& task) {
     std::lock_guard<std::mutex> lock(taskMutex_);
 
-    auto task = taskQueue_.front();
-    taskQueue_.pop();
+    if(currentTask_.id != 0) jobUpdate_ = true;
+    currentTask_ = Task();
+    cancelId_ = 0;
+
+    if(!kill_) {
+      for(auto it = taskQueue_.begin(); it != taskQueue_.end(); ++it) {
+        if(it -> paused) continue;
+
+        task = *it;
+        task.running = true;
+        taskQueue_.erase(it);
+
+        currentTask_ = task;
+        if(task.id != 0) jobUpdate_ = true;
+        return true;
+      }
+    }
 
-    return task;
+    operation_ = false;
+    return false;
   }
 
   void addLogText(const std::string& txt) {
@@ -2494,11 +6361,14 @@ private:
   }
 
   std::mutex taskMutex_, logMutex_, reloadMutex_;
-  std::atomic<bool> operation_, logTextUpDate_, kill_;
+  std::atomic<bool> operation_, logTextUpDate_, jobUpdate_, kill_;
   std::thread thread_;
-  std::queue<Task> taskQueue_;
+  std::deque<Task> taskQueue_;
   std::queue<std::string> reloadPathQueue_;
-  std::atomic<int> pid_, taskCnt_;
+  std::atomic<int> pid_, taskCnt_, lastId_;
+  Task currentTask_;
+  int cancelId_;
+  Journal journal_;
   std::deque<std::string> logText_;
 };
 
@@ -2532,7 +6402,6 @@ public:
     struct tb_event ev;
     int cursor = 0, scrollTop = 0;
     preView_.clear();
-    fflush(stdout);
     tb_clear();
     drawMenuMode(title, menuItems, scrollTop, cursor);
 
@@ -2729,29 +6598,32 @@ public:
   }
 
   void logViewMode() {
-    int line = 0, oldTaskCnt = 0;
+    int line = 0, oldTaskCnt = 0, jobCursor = 0;
 
     struct tb_event ev;
     auto logText = fileOperation_.getLogText();
+    auto jobs = fileOperation_.getJobs();
 
     preView_.clear();
-    fflush(stdout);
     tb_clear();
-    drawLogViewMode(logText, line);
+    drawLogViewMode(logText, line, jobs, jobCursor);
 
     while(1) {
       auto eventStatus = tb_peek_event(&ev, 20);
-      if(fileOperation_.isLogTextUpdate()) {
+      if(fileOperation_.isLogTextUpdate() || fileOperation_.isJobUpdate()) {
         logText = fileOperation_.getLogText();
+        jobs = fileOperation_.getJobs();
+        if(jobCursor >= static_cast<int>(jobs.size())) jobCursor = jobs.size() - 1;
+        if(jobCursor < 0) jobCursor = 0;
+
         tb_clear();
-        drawLogViewMode(logText, line);
+        drawLogViewMode(logText, line, jobs, jobCursor);
       }
 
       if(oldTaskCnt != fileOperation_.getTaskCount()) {
         oldTaskCnt = fileOperation_.getTaskCount();
         printTask();
         tb_present();
-        fflush(stdout);
       }
 
       if(!eventStatus) continue;
@@ -2810,17 +6682,52 @@ public:
             --line;
           }
           break;
+
+        case 'J':
+          if(jobCursor < static_cast<int>(jobs.size()) - 1) ++jobCursor;
+          break;
+
+        case 'K':
+          if(jobCursor > 0) --jobCursor;
+          break;
+
+        case 'x':
+          if(!jobs.empty()) {
+            auto c = getInput("Cancel #" + std::to_string(jobs[jobCursor].id) + "? (y/N)");
+            if(c == 'y' || c == 'Y') fileOperation_.cancelJob(jobs[jobCursor].id);
+          }
+          break;
+
+        case 'p':
+          if(!jobs.empty())
+            fileOperation_.pauseJob(jobs[jobCursor].id, !jobs[jobCursor].paused);
+          break;
+
+        case '+':
+          if(!jobs.empty() && fileOperation_.moveJob(jobs[jobCursor].id, -1))
+            --jobCursor;
+          break;
+
+        case '-':
+          if(!jobs.empty() && fileOperation_.moveJob(jobs[jobCursor].id, 1))
+            ++jobCursor;
+          break;
         }
         break;
 
       case TB_EVENT_RESIZE:
         break;
       }
-      drawLogViewMode(logText, line);
+      jobs = fileOperation_.getJobs();
+      if(jobCursor >= static_cast<int>(jobs.size())) jobCursor = jobs.size() - 1;
+      if(jobCursor < 0) jobCursor = 0;
+
+      drawLogViewMode(logText, line, jobs, jobCursor);
     }
   }
 
-  void drawLogViewMode(const std::deque<std::string>& logText, int line) {
+  void drawLogViewMode(const std::deque<std::string>& logText, int line,
+                       const std::vector<FileOperation::Task>& jobs, int jobCursor) {
     drawText(0, 0, "[LogViewer]", TB_CYAN | TB_BOLD);
 
     std::string txt;
@@ -2828,7 +6735,23 @@ public:
       txt += '-';
     drawText(0, 1, txt);
 
-    for(int i = 0; i < tb_height() - 2; ++i) {
+    // jobs: J/K select, x cancel, p pause/resume, +/- priority
+    int top = 2;
+    if(!jobs.empty()) {
+      int maxJobs = (tb_height() - 2) / 3;
+      int scrollTop = jobCursor >= maxJobs ? jobCursor - maxJobs + 1 : 0;
+
+      drawText(0, top++, "[Jobs] J/K:select x:cancel p:pause/resume +/-:priority", TB_CYAN | TB_BOLD);
+      for(int i = 0; i < maxJobs && i + scrollTop < static_cast<int>(jobs.size()); ++i) {
+        int color = jobs[i + scrollTop].running ? TB_GREEN | TB_BOLD : 0;
+        if(i + scrollTop == jobCursor) color |= TB_REVERSE;
+
+        drawText(0, top++, jobs[i + scrollTop].getJobText(), color, 0, tb_width());
+      }
+      drawText(0, top++, txt);
+    }
+
+    for(int i = 0; i < tb_height() - top; ++i) {
       if(i + line < static_cast<int>(logText.size())) {
         auto txt = logText[i + line];
         if(!txt.empty() && txt.back() == '\n') txt.pop_back();
@@ -2837,7 +6760,7 @@ public:
           for(int j = 0; j < tb_width(); ++j)
             txt += '-';
         }
-        drawText(0, i + 2, txt);
+        drawText(0, i + top, txt);
       }
     }
     printTask();
@@ -2862,12 +6785,14 @@ public:
     preView_.setSize(tb_width() / 2 - 4, tb_height() - 3);
     draw();
 
+    if(pickerMode_ == PICKER_NONE) resumeJournal();
+
     while(1) {
       auto eventStatus = tb_peek_event(&ev, 20);
 
       if(eventStatus == 0) {
         if(!fileViews_[currentFileView_] -> isFileListEmpty()) {
-          if(preView_.getLoadFileName() != fileViews_[currentFileView_] -> getCurrentFileName()) {
+          if(!preView_.isLoadFile(fileViews_[currentFileView_] -> getCurrentFileInfo())) {
             preView_.setLoadFile(fileViews_[currentFileView_] -> getCurrentFileInfo());
             preView_.setDisable(false);
             preViewDraw = false;
@@ -2888,8 +6813,32 @@ public:
         tb_present();
       }
 
+      for(auto&& fileView: fileViews_) {
+        if(fileView -> updateSearch() && fileViews_[currentFileView_] == fileView) {
+          tb_clear();
+          draw();
+        }
+      }
+
+      if(dirSizeCalculator.isUpdate()) {
+        for(auto&& fileView: fileViews_) {
+          if(!fileView -> isDirSizeMode()) continue;
+
+          if(fileView -> updateDirSizes() && fileViews_[currentFileView_] == fileView) {
+            tb_clear();
+            draw();
+          }
+        }
+      }
+
+      if(thumbnailLoader.isUpdate() && fileViews_[currentFileView_] -> drawThumbnails()) {
+        tb_present();
+      }
+
       if(fileOperation_.hasReloadPath()) {
         auto path = fileOperation_.getReloadPath();
+        dirSizeCalculator.invalidate(path);
+
         if(fileViews_[currentFileView_] -> getPath() == path) {
           fileViews_[currentFileView_] -> reload();
 
@@ -2909,9 +6858,18 @@ public:
 
       if(!preViewDraw) {
         preViewDraw = preView_.draw();
+        tb_present();
       }
 
       if(!eventStatus) continue;
+
+      if(ev.type == TB_EVENT_KEY && isCursorMoveKey(ev)) {
+        if(!eventKey(ev.key, ev.ch, ev.mod, preViewDraw)) return;
+
+        drawCursorMove();
+        continue;
+      }
+
       tb_clear();
 
       switch (ev.type) {
@@ -2937,10 +6895,36 @@ public:
     printInfoMessage("");
 
     fileViews_[currentFileView_] -> draw();
+    preView_.draw(false);
+    tb_present();
+  }
+
+  // only the cursor rows of the file view and the file info lines change
+  void drawCursorMove() {
+    fileViews_[currentFileView_] -> drawCursorMove();
+
+    clearLine(0, tb_height() - 2, tb_width());
+    clearLine(0, tb_height() - 1, tb_width());
+    printCurrentFileInfo();
+    printInfoMessage("");
+
     tb_present();
   }
 
 private:
+  void resumeJournal() {
+    auto jobs = fileOperation_.getInterruptedJobs();
+    bool resume = false;
+
+    if(!jobs.empty()) {
+      auto c = getInput("Resume " + std::to_string(jobs.size()) +
+                        " interrupted file operation(s)? (y/N)");
+      resume = (c == 'y' || c == 'Y');
+    }
+
+    fileOperation_.resumeJobs(jobs, resume);
+  }
+
   void resize() {
     if((fileViews_[currentFileView_] -> getWidth() == tb_width() / 2 - 1) &&
        (fileViews_[currentFileView_] -> getHeight() == tb_height() - 3)) return;
@@ -2950,6 +6934,34 @@ private:
     preView_.setSize(tb_width() / 2 - 4, tb_height() - 3);
   }
 
+  bool isCursorMoveKey(const tb_event& ev) const {
+    if(ev.mod & TB_MOD_ALT) return false;
+
+    // h and l only move the cursor in the gallery view
+    if(isGalleryView()) {
+      if(ev.key == TB_KEY_ARROW_LEFT || ev.key == TB_KEY_ARROW_RIGHT) return true;
+      if(ev.key == 0 && (ev.ch == 'h' || ev.ch == 'l')) return true;
+    }
+
+    switch(ev.key) {
+    case TB_KEY_ARROW_DOWN:
+    case TB_KEY_ARROW_UP:
+    case TB_KEY_PGDN:
+    case TB_KEY_CTRL_D:
+    case TB_KEY_PGUP:
+    case TB_KEY_CTRL_U:
+    case TB_KEY_HOME:
+    case TB_KEY_END:
+      return true;
+    };
+
+    return ev.key == 0 && ev.ch != 0 && ev.ch < 0x80 && strchr("jkHMLgG", ev.ch) != 0;
+  }
+
+  bool isGalleryView() const {
+    return fileViews_[currentFileView_] -> getViewType() == FileView::ViewType::GALLERY;
+  }
+
   bool eventKey(uint16_t key, uint32_t ch, uint8_t mod, bool& preViewDraw) {
     if(mod & TB_MOD_ALT) {
       for(const auto& plugin: config.getPlugins()) {
@@ -2989,6 +7001,13 @@ private:
       if(pickerMode_ != PICKER_NONE) {
         if(picker()) return(false);
       }
+      else if(isGalleryView()) openFile();
+      break;
+
+    case TB_KEY_BACKSPACE:
+    case TB_KEY_BACKSPACE2:
+      if(isGalleryView() && !fileViews_[currentFileView_] -> upDir())
+        printInfoMessage(strerror(errno));
       break;
 
     case TB_KEY_PGDN:
@@ -3038,8 +7057,10 @@ private:
       break;
 
     case TB_KEY_CTRL_L:
-      refresh();
+      tb_sync();
+      dirCache.clear();
       fileViews_[currentFileView_] -> reload();
+      fileViews_[currentFileView_] -> recalcDirSizes();
       preViewDraw = false;
       break;
 
@@ -3097,7 +7118,6 @@ private:
     case '3':
     case '4':
       currentFileView_ = ch - '1';
-      refresh();
       fileViews_[currentFileView_] -> reload();
       preViewDraw = false;
       break;
@@ -3150,6 +7170,14 @@ private:
       if(editFile()) preViewDraw = false;
       break;
 
+    case 'f':
+      findFiles();
+      break;
+
+    case 'F':
+      grepFiles();
+      break;
+
     case '/':
       setFileViewFilter();
       break;
@@ -3181,6 +7209,10 @@ private:
       sortFiles();
       break;
 
+    case 'S':
+      toggleDirSizeMode();
+      break;
+
     case '*':
       toggleExecutePermission();
       break;
@@ -3222,19 +7254,23 @@ private:
       break;
 
     case 'j':
-      fileViews_[currentFileView_] -> cursorNext();
+      if(isGalleryView()) fileViews_[currentFileView_] -> cursorNextRow();
+      else fileViews_[currentFileView_] -> cursorNext();
       break;
 
     case 'k':
-      fileViews_[currentFileView_] -> cursorPrev();
+      if(isGalleryView()) fileViews_[currentFileView_] -> cursorPrevRow();
+      else fileViews_[currentFileView_] -> cursorPrev();
       break;
 
     case 'l':
-      openFile();
+      if(isGalleryView()) fileViews_[currentFileView_] -> cursorNext();
+      else openFile();
       break;
 
     case 'h':
-      if(!fileViews_[currentFileView_] -> upDir()) printInfoMessage(strerror(errno));
+      if(isGalleryView()) fileViews_[currentFileView_] -> cursorPrev();
+      else if(!fileViews_[currentFileView_] -> upDir()) printInfoMessage(strerror(errno));
       break;
 
     case 'x':
@@ -3381,7 +7417,13 @@ private:
         for(int i = 0; i < fileViews_[currentFileView_] -> getFileListCount(); ++i)
           currentDirFiles.emplace_back(fileViews_[currentFileView_] -> getFileInfo(i).getFileName());
 
-        if(getReadline(plugin.name + ": ", text, 0, &currentDirFiles)) return;
+        auto complete = [&currentDirFiles](const char* ch, std::vector<std::string>& comp) {
+          for(const auto& line: currentDirFiles) {
+            if(strncmp(line.c_str(), ch, strlen(ch)) == 0)
+              comp.emplace_back(line);
+          }
+        };
+        if(getReadline(plugin.name + ": ", text, 0, complete)) return;
       }
     }
 
@@ -3541,16 +7583,19 @@ private:
       auto fileInfo = fileViews_[currentFileView_] -> getCurrentFileInfo();
       auto newPath = fileInfo.getFilePath();
 
-      if(fileInfo.isDir()) {
+      // a symlink on a slow filesystem is listed without its target
+      struct stat s;
+      bool linkDir = !fileInfo.isDir() && fileInfo.isLink() &&
+        stat(newPath.c_str(), &s) == 0 && S_ISDIR(s.st_mode);
+
+      if(fileInfo.isDir() || linkDir) {
+        if(linkDir) newPath += '/';
         if(!fileViews_[currentFileView_] -> setPath(newPath)) printInfoMessage(strerror(errno));
       }
       else {
-        FILE* fp;
-        if ((fp = fopen(fileInfo.getFilePath().c_str(), "rb")) != NULL) {
-          auto archive = CheckFileType::isArchive(fp);
-          fclose(fp);
-
-          if(archive) {
+        auto type = CheckFileType::classify(fileInfo.getFilePath());
+        if(type != CheckFileType::Type::UNREADABLE) {
+          if(type == CheckFileType::Type::ARCHIVE) {
             openArchive();
             fileViews_[currentFileView_] -> reload();
             resize();
@@ -3618,7 +7663,10 @@ private:
         printInfoMessage("archivemount failed: " + mntdir);
         rmdir(mntdir.c_str());
       }
-      else printInfoMessage("archivemount: " + mntdir);
+      else {
+        clearSlowFsCache();
+        printInfoMessage("archivemount: " + mntdir);
+      }
     }
   }
 
@@ -3641,6 +7689,7 @@ private:
     }
     else {
       rmdir(fileViews_[currentFileView_]->getCurrentFilePath().c_str());
+      clearSlowFsCache();
     }
     fileViews_[currentFileView_] -> reload();
     resize();
@@ -3903,8 +7952,10 @@ private:
     if(!fileViews_[currentFileView_] -> isFileListEmpty()) {
       std::string cmd;
 
-      if(cmdCache_.empty()) updateCmdCache();
-      if(!getReadline("open with: ", cmd, 0, &cmdCache_)) {
+      auto complete = [](const char* ch, std::vector<std::string>& comp) {
+        commandIndex.complete(ch, comp);
+      };
+      if(!getReadline("open with: ", cmd, 0, complete)) {
         auto c = getInput("cli mode? (y/N)");
         bool gui = true;
         if(c == 'y' || c == 'Y') gui = false;
@@ -3951,10 +8002,21 @@ private:
       printInfoMessage("Hide dot files.");
   }
 
+  void toggleDirSizeMode() {
+    auto&& fileView = fileViews_[currentFileView_];
+    fileView -> setDirSizeMode(!fileView -> isDirSizeMode());
+
+    if(fileView -> isDirSizeMode()) {
+      fileView -> setViewType(FileView::ViewType::DETAIL);
+      printInfoMessage("Calculate directory sizes.");
+    }
+    else
+      printInfoMessage("Stop calculating directory sizes.");
+  }
+
   void toggleImagePreview() {
     preView_.setImagePreview(!preView_.isImagePreview());
     preView_.reload();
-    refresh();
     fileViews_[currentFileView_] -> reload();
 
     if(preView_.isImagePreview())
@@ -3966,8 +8028,8 @@ private:
   void setFileViewFilter() {
     std::string filter;
     char buf[256];
-    char typeName[] = {'N', 'R', 'M'};
-    snprintf(buf, sizeof(buf), "Filter[%c]: ", typeName[fileViews_[currentFileView_] -> getFilterType()]);
+    snprintf(buf, sizeof(buf), "Filter[%c]: ",
+             DirInfo::getFilterTypeChar(fileViews_[currentFileView_] -> getFilterType()));
 
     if(!getReadline(buf, filter, 0, 0, &filterHistory_)) {
       if(fileViews_[currentFileView_] -> getFilter() != filter) {
@@ -3985,11 +8047,44 @@ private:
     }
   }
 
+  void findFiles() {
+    std::string filter;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "Find[%c]: ",
+             DirInfo::getFilterTypeChar(fileViews_[currentFileView_] -> getFilterType()));
+
+    if(!getReadline(buf, filter, 0, 0, &filterHistory_) && !filter.empty()) {
+      fileViews_[currentFileView_] -> startSearch(filter,
+                                                  fileViews_[currentFileView_] -> getFilterType());
+
+      if(filterHistory_.end() != std::find(filterHistory_.begin(), filterHistory_.end(), filter)) {
+        filterHistory_.remove(filter);
+      }
+      filterHistory_.emplace_back(filter);
+    }
+  }
+
+  void grepFiles() {
+    std::string pattern;
+
+    if(!getReadline("Grep: ", pattern, 0, 0, &grepHistory_) && !pattern.empty()) {
+      if(!fileViews_[currentFileView_] -> startGrep(pattern)) {
+        printInfoMessage("Invalid pattern");
+        return;
+      }
+
+      if(grepHistory_.end() != std::find(grepHistory_.begin(), grepHistory_.end(), pattern)) {
+        grepHistory_.remove(pattern);
+      }
+      grepHistory_.emplace_back(pattern);
+    }
+  }
+
   void setFileViewFilterType() {
 #ifdef USE_MIGEMO
-    auto c = getInput("'n'(ormal) 'r'(egexp) 'm'(igemo)");
+    auto c = getInput("'n'(ormal) 'r'(egexp) 'm'(igemo) 'f'(uzzy)");
 #else
-    auto c = getInput("'n'(ormal) 'r'(egexp)");
+    auto c = getInput("'n'(ormal) 'r'(egexp) 'f'(uzzy)");
 #endif
 
     DirInfo::FilterType type = fileViews_[currentFileView_] -> getFilterType();
@@ -4005,6 +8100,9 @@ private:
       type = DirInfo::FilterType::MIGEMO;
       break;
 #endif
+    case 'f':
+      type = DirInfo::FilterType::FUZZY;
+      break;
     };
 
     if(fileViews_[currentFileView_] -> getFilterType() == type) return;
@@ -4012,30 +8110,17 @@ private:
     fileViews_[currentFileView_] -> setCursorPos(0);
   }
 
-  void refresh() {
-    for(auto i = 1; i < tb_height() + 1; ++i) {
-      printf("\e[%d;%dH", i, 0);
-      printf("\e[K");
-      fflush(stdout);
-      eraseLineFrontBuffer(i - 1);
-    }
-  }
-
-  void eraseLineFrontBuffer(int y) const {
-    for(int i = 0; i < tb_width(); ++i) {
-      tb_change_cell_front(i, y, ' ', 0, 0);
-    }
-  }
-
   void changeFileViewType() {
-    if(fileViews_[currentFileView_] -> getViewType() == FileView::ViewType::DETAIL)
+    if(fileViews_[currentFileView_] -> getViewType() == FileView::ViewType::GALLERY)
       fileViews_[currentFileView_] -> setViewType(FileView::ViewType::SIMPLE);
+    else if(fileViews_[currentFileView_] -> getViewType() == FileView::ViewType::DETAIL)
+      fileViews_[currentFileView_] -> setViewType(FileView::ViewType::GALLERY);
     else if(fileViews_[currentFileView_] -> getViewType() == FileView::ViewType::SIMPLE)
       fileViews_[currentFileView_] -> setViewType(FileView::ViewType::DETAIL);
   }
 
   bool getReadline(const std::string& prompt, std::string& buf,
-                   const char* txt = 0, std::vector<std::string>* complist = 0,
+                   const char* txt = 0, linenoise::CompletionCallback complete = nullptr,
                    std::list<std::string>* history = 0) const {
     printf("\e[%d;%dH\e[K", tb_height(), 0);
     printf("\e[27;22m");
@@ -4049,20 +8134,13 @@ private:
       }
     }
 
-    if(complist != 0) {
-      linenoise::SetCompletionCallback([complist](const char*ch, std::vector<std::string>& comp) {
-                                         for(auto line: *complist) {
-                                           if(strncmp(line.c_str(), ch, strlen(ch)) == 0)
-                                             comp.emplace_back(line);
-                                         }
-                                       });
-    }
+    linenoise::SetCompletionCallback(complete);
     auto result = linenoise::Readline(prompt.c_str(), buf, txt);
 
     printf("\e[?25l"); // hide cursor
     printf("\e[%d;%dH\e[K", tb_height(), 0);
     fflush(stdout);
-    eraseLineFrontBuffer(tb_height() - 1);
+    tb_invalidate(0, tb_height() - 1, tb_width(), 1);
 
     return result;
   }
@@ -4078,7 +8156,7 @@ private:
       if(ev.type == TB_EVENT_KEY) {
         printf("\e[%d;%dH\e[K", tb_height(), 0);
         fflush(stdout);
-        eraseLineFrontBuffer(tb_height() - 1);
+        tb_invalidate(0, tb_height() - 1, tb_width(), 1);
 
         return ev.ch;
       }
@@ -4141,7 +8219,13 @@ private:
     drawText(0, 0, txt, 0);
     drawText(currentFileView_ + 1, 0, std::to_string(currentFileView_ + 1), TB_REVERSE);
 
-    drawText(0 + txt.length(), 0, path, TB_CYAN | TB_BOLD);
+    int len = drawText(0 + txt.length(), 0, path, TB_CYAN | TB_BOLD);
+
+    if(fileViews_[currentFileView_] -> isSearchMode()) {
+      std::string label = " [" + fileViews_[currentFileView_] -> getSearchLabel() +
+        (fileViews_[currentFileView_] -> isSearching() ? " ...]" : "]");
+      drawText(txt.length() + len, 0, label, TB_YELLOW | TB_BOLD);
+    }
   }
 
   int printSelectFilesCnt() const {
@@ -4193,28 +8277,12 @@ private:
     }
   }
 
-  void updateCmdCache() {
-    if(getenv("PATH") == 0) return;
-
-    std::istringstream stream(std::string(getenv("PATH")));
-    std::string path;
-
-    while (std::getline(stream, path, ':')) {
-      auto dir = DirInfo(path);
-      for(int i = 0; i < dir.getCount(); ++i) {
-        auto fileInfo = dir.at(i);
-        if(!fileInfo.isDir())
-          cmdCache_.emplace_back(fileInfo.getFileName());
-      }
-    }
-  }
-
   std::array<std::unique_ptr<FileView>, TAB_MAX> fileViews_;
   PreView preView_;
   FileOperation fileOperation_;
 
-  std::vector<std::string> cmdCache_;
   std::list<std::string> filterHistory_;
+  std::list<std::string> grepHistory_;
   struct Buffer {
     FileOperation::Task::Operation operation;
     std::vector<std::string> selectedFiles;
@@ -4314,6 +8382,9 @@ int main(int argc, char **argv)
     output = parser.get<std::string>("choosefiles");
   }
 
+  // the command completion of "open with" is ready before it is needed
+  commandIndex.prefetch();
+
   Minase minase(path, mode, output);
   minase.run();
 
@@ -54,8 +54,23 @@ static void bytebuffer_resize(struct bytebuffer *b, int len) {
 	b->len = len;
 }
 
+static void bytebuffer_prepend(struct bytebuffer *b, const char *data, int len) {
+	bytebuffer_reserve(b, b->len + len);
+	memmove(b->buf + len, b->buf, b->len);
+	memcpy(b->buf, data, len);
+	b->len += len;
+}
+
 static void bytebuffer_flush(struct bytebuffer *b, int fd) {
-	write(fd, b->buf, b->len);
+	int off = 0;
+	// usually done by a single write, unless it is interrupted (e.g. SIGWINCH)
+	while (off < b->len) {
+		ssize_t n = write(fd, b->buf + off, b->len - off);
+		if (n < 0 && errno != EINTR)
+			break;
+		if (n > 0)
+			off += n;
+	}
 	bytebuffer_clear(b);
 }
 
@@ -37,8 +37,16 @@ static struct termios orig_tios;
 
 static struct cellbuf back_buffer;
 static struct cellbuf front_buffer;
+
+/* rows written since the last tb_present(), only these are compared */
+static unsigned char *dirty_rows = NULL;
 static struct bytebuffer output_buffer;
 static struct bytebuffer input_buffer;
+/* tb_put_raw() data, sent after the cells by tb_present() */
+static struct bytebuffer raw_buffer;
+
+/* synchronized output (DEC mode 2026): -1 = not detected yet, 0 = no, 1 = yes */
+static int sync_output = -1;
 
 static int termw = -1;
 static int termh = -1;
@@ -67,11 +75,15 @@ static void cellbuf_resize(struct cellbuf *buf, int width, int height);
 static void cellbuf_clear(struct cellbuf *buf);
 static void cellbuf_free(struct cellbuf *buf);
 
+static void dirty_rows_resize(int height);
+static void mark_dirty_rows(int y, int h);
+
 static void update_size(void);
 static void update_term_size(void);
 static void send_attr(uint16_t fg, uint16_t bg);
 static void send_char(int x, int y, uint32_t c);
 static void send_clear(void);
+static int detect_sync_output(void);
 static void sigwinch_handler(int xxx);
 static int wait_fill_event(struct tb_event *event, struct timeval *timeout);
 
@@ -79,10 +91,68 @@ static int wait_fill_event(struct tb_event *event, struct timeval *timeout);
 static volatile int buffer_size_change_request;
 
 int (*func_wcwidth)(const wchar_t c) = wcwidth;
+
+/* The widths of the code points, looked up in O(1). A block of 256 widths
+ * is filled by func_wcwidth on the first lookup of one of its code points,
+ * so only the blocks that are used are built (mostly a few). The blocks of
+ * width 1 (most of the alphabetic scripts) share one static block. The
+ * widths depend on the locale (wcwidth) and not on anything else, so they
+ * are kept until the process exits. */
+#define WIDTH_BLOCK_BITS 8
+#define WIDTH_BLOCK_SIZE (1 << WIDTH_BLOCK_BITS)
+#define WIDTH_BLOCKS (0x110000 >> WIDTH_BLOCK_BITS)
+
+struct width_table {
+	int (*func)(const wchar_t c);
+	signed char *blocks[WIDTH_BLOCKS];
+};
+
+static struct width_table width_table_normal = { wcwidth, { 0 } };
+static struct width_table width_table_cjk = { wcwidth_cjk, { 0 } };
+static struct width_table *width_table = &width_table_normal;
+static signed char width_block_narrow[WIDTH_BLOCK_SIZE] = { [0 ... WIDTH_BLOCK_SIZE - 1] = 1 };
 /* -------------------------------------------------------- */
 
+/* may be called by more than one thread, the loser of the race frees its
+ * block */
+static signed char *width_block_init(struct width_table *table, uint32_t n)
+{
+	signed char *block = malloc(WIDTH_BLOCK_SIZE);
+	signed char *expected = NULL;
+	int i, narrow = 1;
+
+	for (i = 0; i < WIDTH_BLOCK_SIZE; ++i) {
+		block[i] = table->func((wchar_t)((n << WIDTH_BLOCK_BITS) | i));
+		if (block[i] != 1)
+			narrow = 0;
+	}
+
+	if (narrow) {
+		free(block);
+		block = width_block_narrow;
+	}
+
+	if (!__atomic_compare_exchange_n(&table->blocks[n], &expected, block, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		if (block != width_block_narrow)
+			free(block);
+		block = expected;
+	}
+	return block;
+}
+
 int tb_wcwidth(const wchar_t c) {
-  return func_wcwidth(c);
+	struct width_table *table = width_table;
+	uint32_t u = (uint32_t)c;
+	signed char *block;
+
+	if (u >= 0x110000)
+		return table->func(c);
+
+	block = __atomic_load_n(&table->blocks[u >> WIDTH_BLOCK_BITS], __ATOMIC_ACQUIRE);
+	if (!block)
+		block = width_block_init(table, u >> WIDTH_BLOCK_BITS);
+	return block[u & (WIDTH_BLOCK_SIZE - 1)];
 }
 
 int tb_init_fd(int inout_)
@@ -125,6 +195,11 @@ int tb_init_fd(int inout_)
 
 	bytebuffer_init(&input_buffer, 128);
 	bytebuffer_init(&output_buffer, 32 * 1024);
+	bytebuffer_init(&raw_buffer, 0);
+
+	/* checked once, tb_init() is called again after every child process */
+	if (sync_output == -1)
+		sync_output = detect_sync_output();
 
 	bytebuffer_puts(&output_buffer, funcs[T_ENTER_CA]);
 	bytebuffer_puts(&output_buffer, funcs[T_ENTER_KEYPAD]);
@@ -136,6 +211,7 @@ int tb_init_fd(int inout_)
 	cellbuf_init(&front_buffer, termw, termh);
 	cellbuf_clear(&back_buffer);
 	cellbuf_clear(&front_buffer);
+	dirty_rows_resize(termh);
 
 	return 0;
 }
@@ -143,6 +219,7 @@ int tb_init_fd(int inout_)
 void tb_use_wcwidth_cjk(int flg){
 	if(flg == 0) func_wcwidth = wcwidth;
 	else func_wcwidth = wcwidth_cjk;
+	width_table = (flg == 0) ? &width_table_normal : &width_table_cjk;
 }
 
 int tb_init_file(const char* name){
@@ -180,8 +257,11 @@ void tb_shutdown(void)
 
 	cellbuf_free(&back_buffer);
 	cellbuf_free(&front_buffer);
+	free(dirty_rows);
+	dirty_rows = NULL;
 	bytebuffer_free(&output_buffer);
 	bytebuffer_free(&input_buffer);
+	bytebuffer_free(&raw_buffer);
 	termw = termh = -1;
 }
 
@@ -200,10 +280,14 @@ void tb_present(void)
 	}
 
 	for (y = 0; y < front_buffer.height; ++y) {
+		if (!dirty_rows[y])
+			continue;
+		dirty_rows[y] = 0;
+
 		for (x = 0; x < front_buffer.width; ) {
 			back = &CELL(&back_buffer, x, y);
 			front = &CELL(&front_buffer, x, y);
-			w = func_wcwidth(back->ch);
+			w = tb_wcwidth(back->ch);
 			if (w < 1) w = 1;
 			if (memcmp(back, front, sizeof(struct tb_cell)) == 0) {
 				x += w;
@@ -228,9 +312,73 @@ void tb_present(void)
 			x += w;
 		}
 	}
+	if (raw_buffer.len > 0) {
+		bytebuffer_append(&output_buffer, raw_buffer.buf, raw_buffer.len);
+		bytebuffer_clear(&raw_buffer);
+		/* the raw data moves the cursor */
+		lastx = LAST_COORD_INIT;
+		lasty = LAST_COORD_INIT;
+	}
 	if (!IS_CURSOR_HIDDEN(cursor_x, cursor_y))
 		write_cursor(cursor_x, cursor_y);
-	bytebuffer_flush(&output_buffer, inout);
+	if (output_buffer.len > 0) {
+		/* the terminal shows the frame only when it is complete */
+		if (sync_output == 1) {
+			bytebuffer_prepend(&output_buffer, "\033[?2026h", 8);
+			bytebuffer_puts(&output_buffer, "\033[?2026l");
+		}
+		bytebuffer_flush(&output_buffer, inout);
+	}
+}
+
+void tb_put_raw(int x, int y, const char *data, int len)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "\033[%d;%dH", y + 1, x + 1);
+	bytebuffer_puts(&raw_buffer, buf);
+	bytebuffer_append(&raw_buffer, data, len);
+}
+
+void tb_invalidate(int x, int y, int w, int h)
+{
+	int i, j;
+
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (w > front_buffer.width - x)
+		w = front_buffer.width - x;
+	if (h > front_buffer.height - y)
+		h = front_buffer.height - y;
+	if (w <= 0 || h <= 0)
+		return;
+
+	/* no cell of the back buffer has these values */
+	for (j = y; j < y + h; ++j) {
+		for (i = x; i < x + w; ++i) {
+			CELL(&front_buffer, i, j).ch = 0xFFFFFFFF;
+			CELL(&front_buffer, i, j).fg = 0xFFFF;
+			CELL(&front_buffer, i, j).bg = 0xFFFF;
+		}
+	}
+	mark_dirty_rows(y, h);
+}
+
+void tb_sync(void)
+{
+	cellbuf_clear(&front_buffer);
+	mark_dirty_rows(0, front_buffer.height);
+
+	/* sent with the next tb_present() in the same frame */
+	send_attr(foreground, background);
+	bytebuffer_puts(&output_buffer, funcs[T_CLEAR_SCREEN]);
+	lastx = LAST_COORD_INIT;
+	lasty = LAST_COORD_INIT;
 }
 
 void tb_set_cursor(int cx, int cy)
@@ -254,6 +402,7 @@ void tb_put_cell(int x, int y, const struct tb_cell *cell)
 	if ((unsigned)y >= (unsigned)back_buffer.height)
 		return;
 	CELL(&back_buffer, x, y) = *cell;
+	dirty_rows[y] = 1;
 }
 
 void tb_put_cell_front(int x, int y, const struct tb_cell *cell)
@@ -263,6 +412,7 @@ void tb_put_cell_front(int x, int y, const struct tb_cell *cell)
 	if ((unsigned)y >= (unsigned)back_buffer.height)
 		return;
 	CELL(&front_buffer, x, y) = *cell;
+	dirty_rows[y] = 1;
 }
 
 void tb_change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg)
@@ -309,10 +459,13 @@ void tb_blit(int x, int y, int w, int h, const struct tb_cell *cells)
 		dst += back_buffer.width;
 		src += w;
 	}
+	mark_dirty_rows(y, hh);
 }
 
 struct tb_cell *tb_cell_buffer(void)
 {
+	/* the caller may write anywhere */
+	mark_dirty_rows(0, back_buffer.height);
 	return back_buffer.cells;
 }
 
@@ -346,6 +499,7 @@ void tb_clear(void)
 		buffer_size_change_request = 0;
 	}
 	cellbuf_clear(&back_buffer);
+	mark_dirty_rows(0, back_buffer.height);
 }
 
 int tb_select_input_mode(int mode)
@@ -506,6 +660,19 @@ static void cellbuf_free(struct cellbuf *buf)
 	free(buf->cells);
 }
 
+static void dirty_rows_resize(int height)
+{
+	free(dirty_rows);
+	dirty_rows = (unsigned char*)malloc(height);
+	assert(dirty_rows);
+	mark_dirty_rows(0, height);
+}
+
+static void mark_dirty_rows(int y, int h)
+{
+	memset(dirty_rows + y, 1, h);
+}
+
 static void get_term_size(int *w, int *h)
 {
 	struct winsize sz;
@@ -608,6 +775,89 @@ static void send_clear(void)
 	lasty = LAST_COORD_INIT;
 }
 
+/* parses "ESC [ ? params $y" (DECRPM) and "ESC [ ? params c" (DA1), returns
+ * the length of the sequence at 'p' or 0 */
+static int parse_query_reply(const char *p, int len, int *mode, int *value, char *final)
+{
+	int i = 3, n = 0, v = 0;
+
+	if (len < 3 || p[0] != '\033' || p[1] != '[' || p[2] != '?')
+		return 0;
+	for (; i < len && ((p[i] >= '0' && p[i] <= '9') || p[i] == ';'); ++i) {
+		if (p[i] == ';') {
+			if (++n == 1)
+				*mode = v;
+			v = 0;
+		} else {
+			v = v * 10 + (p[i] - '0');
+		}
+	}
+	*value = v;
+	if (i < len && p[i] == 'c') {
+		*final = 'c';
+		return i + 1;
+	}
+	if (i + 1 < len && p[i] == '$' && p[i + 1] == 'y') {
+		*final = 'y';
+		return i + 2;
+	}
+	return 0;
+}
+
+/* asks the terminal whether it supports synchronized output (DECRQM ?2026).
+ * DA1 is sent after it, every terminal answers it, so we don't have to wait
+ * for the timeout when DECRQM is not supported. */
+static int detect_sync_output(void)
+{
+	static const char query[] = "\033[?2026$p\033[c";
+	char buf[256];
+	int len = 0, i, supported = 0, done = 0;
+
+	if (write(inout, query, sizeof(query) - 1) != sizeof(query) - 1)
+		return 0;
+
+	while (!done && len < (int)sizeof(buf)) {
+		fd_set events;
+		struct timeval timeout = {1, 0};
+		FD_ZERO(&events);
+		FD_SET(inout, &events);
+		if (select(inout + 1, &events, 0, 0, &timeout) <= 0)
+			break;
+
+		ssize_t n = read(inout, buf + len, sizeof(buf) - len);
+		if (n <= 0)
+			break;
+		len += n;
+
+		for (i = 0; i < len; ++i) {
+			int mode = 0, value = 0;
+			char final = 0;
+			if (parse_query_reply(buf + i, len - i, &mode, &value, &final) &&
+			    final == 'c')
+				done = 1;
+		}
+	}
+
+	/* keys typed in the meantime are kept as input */
+	for (i = 0; i < len;) {
+		int mode = 0, value = 0;
+		char final = 0;
+		int n = parse_query_reply(buf + i, len - i, &mode, &value, &final);
+		if (n == 0) {
+			bytebuffer_append(&input_buffer, buf + i, 1);
+			++i;
+			continue;
+		}
+		/* 1: set, 2: reset, 3: permanently set, 4: permanently reset
+		 * (the mode can never be enabled) */
+		if (final == 'y' && mode == 2026 && value >= 1 && value <= 3)
+			supported = 1;
+		i += n;
+	}
+
+	return supported;
+}
+
 static void sigwinch_handler(int xxx)
 {
 	(void) xxx;
@@ -621,6 +871,7 @@ static void update_size(void)
 	cellbuf_resize(&back_buffer, termw, termh);
 	cellbuf_resize(&front_buffer, termw, termh);
 	cellbuf_clear(&front_buffer);
+	dirty_rows_resize(termh);
 	send_clear();
 }
 
@@ -197,7 +197,9 @@ SO_IMPORT int tb_height(void);
 SO_IMPORT void tb_clear(void);
 SO_IMPORT void tb_set_clear_attributes(uint16_t fg, uint16_t bg);
 
-/* Synchronizes the internal back buffer with the terminal. */
+/* Synchronizes the internal back buffer with the terminal. Only the rows
+ * that have been written since the last call are compared.
+ */
 SO_IMPORT void tb_present(void);
 
 #define TB_HIDE_CURSOR -1
@@ -217,6 +219,22 @@ SO_IMPORT void tb_change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t b
 SO_IMPORT void tb_put_cell_front(int x, int y, const struct tb_cell *cell);
 SO_IMPORT void tb_change_cell_front(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg);
 
+/* Sends raw data (e.g. a sixel image) at the specified position. It is
+ * written after the cells by the next tb_present() call.
+ */
+SO_IMPORT void tb_put_raw(int x, int y, const char *data, int len);
+
+/* Forgets what is on the screen in the specified area, so that the next
+ * tb_present() call sends every cell of it again. Use it when the area has
+ * been drawn over without termbox, e.g. by tb_put_raw().
+ */
+SO_IMPORT void tb_invalidate(int x, int y, int w, int h);
+
+/* Clears the terminal and sends the whole back buffer again with the next
+ * tb_present() call.
+ */
+SO_IMPORT void tb_sync(void);
+
 /* Copies the buffer from 'cells' at the specified position, assuming the
  * buffer is a two-dimensional array of size ('w' x 'h'), represented as a
  * one-dimensional buffer containing lines of cells starting from the top.